@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Writes the lowest `count` bytes of `val` in little endian
+/// @returns The end of the bytes written
+static inline uint8_t* bytes_put(uint8_t* p_buf, uint64_t val, int count) {
+    for (int i = 0; i < count; i++) *(p_buf++) = val >> (8 * i);
+    return p_buf;
+}
+
+/// Reads `count` bytes in little endian into `p_val`
+/// @returns The end of the bytes read
+static inline const uint8_t* bytes_get(const uint8_t* p_buf,
+                                       uint64_t* p_val,
+                                       int count) {
+    *p_val = 0;
+    for (int i = 0; i < count; i++) *p_val |= (uint64_t)*(p_buf++) << (8 * i);
+    return p_buf;
+}
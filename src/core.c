@@ -125,16 +125,50 @@ const uint8_t DEFAULT_FONT[16 * 5] = {
 };
 
 
-void push(MachineState* p_machineState, uint16_t val) {
+void raiseFault(MachineState* p_machineState, CoreFault fault) {
+    p_machineState->fault = fault;
+    p_machineState->sigIllHandler();
+}
+
+/// @returns Whether there was space on the stack
+bool push(MachineState* p_machineState, uint16_t val) {
+    if (p_machineState->stackIdx >= 16) {
 #if DEBUG
-    if (p_machineState->stackIdx > 16) printf("Stack overflow!\n");
+        printf("Stack overflow!\n");
 #endif
+        raiseFault(p_machineState, CORE_FAULT_STACK_OVERFLOW);
+        return false;
+    }
 
-    p_machineState->stack[(p_machineState->stackIdx)++ % 16] = val;
+    p_machineState->stack[(p_machineState->stackIdx)++] = val;
+    return true;
 }
 
-uint16_t pop(MachineState* p_machineState) {
-    return p_machineState->stack[--(p_machineState->stackIdx)];
+/// @returns Whether there was an address on the stack
+bool pop(MachineState* p_machineState, uint16_t* p_val) {
+    if (p_machineState->stackIdx == 0) {
+#if DEBUG
+        printf("Stack underflow!\n");
+#endif
+        raiseFault(p_machineState, CORE_FAULT_STACK_UNDERFLOW);
+        return false;
+    }
+
+    *p_val = p_machineState->stack[--(p_machineState->stackIdx)];
+    return true;
+}
+
+
+// Arbitrary non-zero seed, hosts can overwrite `rngState` after `core_init`
+#define DEFAULT_RNG_SEED 0x2545F491
+
+uint8_t nextRandom(MachineState* p_machineState) {
+    uint32_t x = p_machineState->rngState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    p_machineState->rngState = x;
+    return x;
 }
 
 
@@ -147,6 +181,7 @@ void core_init(MachineState* p_machineState,
                void (*clearDisplay)(),
                void (*sigIllHandler)()) {
     p_machineState->programCounter = 0x0200;
+    p_machineState->rngState = DEFAULT_RNG_SEED;
     p_machineState->heldKeys = heldKeys;
     p_machineState->getPixel = getPixel;
     p_machineState->togglePixel = togglePixel;
@@ -183,8 +218,6 @@ void core_timerTick(MachineState* p_machineState) {
     if (p_machineState->soundTimer > 0) p_machineState->soundTimer--;
 }
 
-uint16_t g_previousHeldKeys = 0;
-
 bool core_tick(MachineState* p_machineState) {
     /* FETCH */
     uint16_t instruction =
@@ -231,8 +264,8 @@ bool core_tick(MachineState* p_machineState) {
                             return true;
 
                         case 0xE:
-                            p_machineState->programCounter =
-                                pop(p_machineState);
+                            pop(p_machineState,
+                                &p_machineState->programCounter);
                             return false;
                     }
                     break;
@@ -246,8 +279,8 @@ bool core_tick(MachineState* p_machineState) {
             return false;
 
         case 0x2:
-            push(p_machineState, p_machineState->programCounter);
-            p_machineState->programCounter = NNN;
+            if (push(p_machineState, p_machineState->programCounter))
+                p_machineState->programCounter = NNN;
             return false;
 
         case 0x3:
@@ -342,7 +375,7 @@ bool core_tick(MachineState* p_machineState) {
             return false;
 
         case 0xC:
-            VX = rand() & NN;
+            VX = nextRandom(p_machineState) & NN;
             return false;
 
         case 0xD: {
@@ -407,17 +440,17 @@ bool core_tick(MachineState* p_machineState) {
                 case 0x0A: {
                     uint16_t currentHeldKeys = p_machineState->heldKeys();
 
-                    if (currentHeldKeys < g_previousHeldKeys) {
+                    if (currentHeldKeys < p_machineState->previousHeldKeys) {
                         uint16_t keysDiff =
-                            g_previousHeldKeys - currentHeldKeys;
+                            p_machineState->previousHeldKeys - currentHeldKeys;
                         for (int i = 0; i < 16; i++)
                             if (keysDiff >> i & 0b1) {
                                 VX = i;
                                 break;
                             };
-                        g_previousHeldKeys = 0;
+                        p_machineState->previousHeldKeys = 0;
                     } else {
-                        g_previousHeldKeys = currentHeldKeys;
+                        p_machineState->previousHeldKeys = currentHeldKeys;
                         p_machineState->programCounter -= 2;
                     }
 
@@ -461,7 +494,7 @@ bool core_tick(MachineState* p_machineState) {
 #if DEBUG
     printf("Instruction not implemented\n");
 #endif
-    p_machineState->sigIllHandler();
+    raiseFault(p_machineState, CORE_FAULT_ILLEGAL_INSTRUCTION);
 
     return false;
 }
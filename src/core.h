@@ -4,6 +4,17 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/// Why the machine last called `sigIllHandler`
+typedef enum CoreFault {
+    CORE_FAULT_NONE,
+    /// The instruction isn't implemented
+    CORE_FAULT_ILLEGAL_INSTRUCTION,
+    /// `2NNN` with 16 addresses already on the stack, the call is skipped
+    CORE_FAULT_STACK_OVERFLOW,
+    /// `00EE` with an empty stack, the return is skipped
+    CORE_FAULT_STACK_UNDERFLOW,
+} CoreFault;
+
 /// Holds the state of the emulated machine
 typedef struct MachineState {
 #ifndef CORE_RAM_SIZE
@@ -27,6 +38,17 @@ typedef struct MachineState {
     uint8_t delayTimer;
     uint8_t soundTimer;
 
+    /// The keys that were held the last time `FX0A` polled for a key press.
+    /// Kept per machine so that multiple machines can wait for keys at once.
+    uint16_t previousHeldKeys;
+
+    /// State of the xorshift generator used by `CXNN`, must never be 0.
+    /// Kept in the machine state so that snapshots replay identically.
+    uint32_t rngState;
+
+    /// Set just before `sigIllHandler` is called
+    CoreFault fault;
+
     /* CALLBACKS */
 
     /**
@@ -63,7 +85,12 @@ typedef struct MachineState {
     /// Clears the display to off
     void (*clearDisplay)();
 
-    /// Handles an illegal instruction
+    /**
+     * Handles an illegal instruction or a stack overflow/underflow.
+     *
+     * The program counter points just past the faulting instruction, and
+     * `fault` holds the reason.
+     */
     void (*sigIllHandler)();
 } MachineState;
 
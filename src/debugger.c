@@ -0,0 +1,781 @@
+#include "debugger.h"
+
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+
+#define MAX_BREAKPOINTS 32
+#define MAX_WATCHPOINTS 16
+#define CONSOLE_LINE_LEN 256
+
+// Registers are numbered V0-VF followed by these
+#define REG_I 16
+#define REG_DT 17
+#define REG_ST 18
+#define REG_SP 19
+#define REG_PC 20
+// The registers that can be watched
+#define WATCHABLE_REGS 19
+
+#define WATCH_READ 0b01
+#define WATCH_WRITE 0b10
+
+
+typedef enum ConditionOp {
+    OP_NONE,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+} ConditionOp;
+
+/// `REG op value` or `[addr] op value`
+typedef struct Condition {
+    ConditionOp op;
+    bool isMemory;
+    /// A register number, or a RAM address if `isMemory`
+    uint16_t operand;
+    uint16_t value;
+} Condition;
+
+typedef struct Breakpoint {
+    int id;
+    uint16_t addr;
+    Condition condition;
+} Breakpoint;
+
+typedef struct Watchpoint {
+    int id;
+    bool isRegister;
+    /// An inclusive RAM range, or a register number in `start`
+    uint16_t start;
+    uint16_t end;
+    uint8_t mode;
+} Watchpoint;
+
+/// What an instruction is about to access
+typedef struct Accesses {
+    uint32_t regsRead;
+    uint32_t regsWritten;
+    /// Inclusive RAM ranges, empty when `start > end`. They wrap around to the
+    /// start of RAM past `CORE_RAM_SIZE - 1`, like `core_tick`'s accesses.
+    uint16_t memReadStart, memReadEnd;
+    uint16_t memWriteStart, memWriteEnd;
+} Accesses;
+
+typedef enum StepMode {
+    STEP_NONE,
+    STEP_INTO,
+    STEP_OVER,
+    STEP_OUT,
+} StepMode;
+
+
+bool (*debugger_tick)(MachineState* p_machineState) = &core_tick;
+
+MachineState* gp_debuggee = NULL;
+bool g_stopped = false;
+// Calls to `debugger_tick` that executed nothing since the machine stopped
+uint64_t g_skippedTicks = 0;
+int g_nextId = 1;
+
+Breakpoint g_breakpoints[MAX_BREAKPOINTS];
+int g_breakpointCount = 0;
+// Bit `addr % 64` of element `addr / 64` is set for each breakpoint, so
+// checking the program counter is a single lookup
+uint64_t g_breakpointMap[CORE_RAM_SIZE / 64] = {};
+Watchpoint g_watchpoints[MAX_WATCHPOINTS];
+int g_watchpointCount = 0;
+
+// Set when resuming from a breakpoint, whose instruction has to be executed
+// without stopping again
+bool g_resumePending = false;
+uint16_t g_resumeAddr = 0;
+
+StepMode g_stepMode = STEP_NONE;
+uint16_t g_stepTarget = 0;
+uint8_t g_stepDepth = 0;
+
+bool g_consoleClosed = false;
+char g_consoleLine[CONSOLE_LINE_LEN];
+size_t g_consoleLineLen = 0;
+
+
+/* MACHINE ACCESS */
+
+Breakpoint* findBreakpoint(uint16_t addr) {
+    for (int i = 0; i < g_breakpointCount; i++)
+        if (g_breakpoints[i].addr == addr) return &g_breakpoints[i];
+    return NULL;
+}
+
+bool isBreakpoint(uint16_t addr) {
+    return g_breakpointMap[addr / 64] >> (addr % 64) & 0b1;
+}
+
+void updateBreakpointMap() {
+    memset(g_breakpointMap, 0, sizeof(g_breakpointMap));
+    for (int i = 0; i < g_breakpointCount; i++)
+        g_breakpointMap[g_breakpoints[i].addr / 64] |=
+            1ull << (g_breakpoints[i].addr % 64);
+}
+
+uint8_t readRam(uint16_t addr) {
+    return gp_debuggee->ram[addr % CORE_RAM_SIZE];
+}
+
+uint16_t readInstruction(uint16_t addr) {
+    return readRam(addr) << 8 | readRam(addr + 1);
+}
+
+uint16_t readRegister(int reg) {
+    if (reg < 16) return gp_debuggee->varRegs[reg];
+
+    switch (reg) {
+        case REG_I:
+            return gp_debuggee->indexReg;
+        case REG_DT:
+            return gp_debuggee->delayTimer;
+        case REG_ST:
+            return gp_debuggee->soundTimer;
+        case REG_SP:
+            return gp_debuggee->stackIdx;
+        case REG_PC:
+            return gp_debuggee->programCounter;
+    }
+    return 0;
+}
+
+/// Finds out what `instruction` will access, following `core_tick`
+void decodeAccesses(uint16_t instruction, Accesses* p_accesses) {
+    int x = (instruction & 0x0F00) >> 8;
+    int y = (instruction & 0x00F0) >> 4;
+    int n = instruction & 0x000F;
+    uint16_t i = gp_debuggee->indexReg % CORE_RAM_SIZE;
+
+    *p_accesses = (Accesses){.memReadStart = 1, .memWriteStart = 1};
+    uint32_t vx = 1u << x, vy = 1u << y, vf = 1u << 0xF;
+    // V0 up to and including VX
+    uint32_t v0ToVx = (2u << x) - 1;
+
+    switch (instruction >> 12) {
+        case 0x3:
+        case 0x4:
+        case 0x7:
+            p_accesses->regsRead = vx;
+            p_accesses->regsWritten = (instruction >> 12) == 0x7 ? vx : 0;
+            break;
+        case 0x5:
+        case 0x9:
+            p_accesses->regsRead = vx | vy;
+            break;
+        case 0x6:
+        case 0xC:
+            p_accesses->regsWritten = vx;
+            break;
+        case 0x8:
+            p_accesses->regsRead = (n == 0x0 || n == 0x6 || n == 0xE)
+                                       ? vy
+                                       : vx | vy;
+            p_accesses->regsWritten = n == 0x0 ? vx : vx | vf;
+            break;
+        case 0xA:
+            p_accesses->regsWritten = 1u << REG_I;
+            break;
+        case 0xB:
+            p_accesses->regsRead = 1u << 0x0;
+            break;
+        case 0xD:
+            p_accesses->regsRead = vx | vy | 1u << REG_I;
+            p_accesses->regsWritten = vf;
+            if (n > 0) {
+                p_accesses->memReadStart = i;
+                p_accesses->memReadEnd = i + n - 1;
+            }
+            break;
+        case 0xE:
+            p_accesses->regsRead = vx;
+            break;
+        case 0xF:
+            switch (instruction & 0x00FF) {
+                case 0x07:
+                    p_accesses->regsRead = 1u << REG_DT;
+                    p_accesses->regsWritten = vx;
+                    break;
+                case 0x0A:
+                    p_accesses->regsWritten = vx;
+                    break;
+                case 0x15:
+                    p_accesses->regsRead = vx;
+                    p_accesses->regsWritten = 1u << REG_DT;
+                    break;
+                case 0x18:
+                    p_accesses->regsRead = vx;
+                    p_accesses->regsWritten = 1u << REG_ST;
+                    break;
+                case 0x1E:
+                    p_accesses->regsRead = vx | 1u << REG_I;
+                    p_accesses->regsWritten = 1u << REG_I;
+                    break;
+                case 0x29:
+                    p_accesses->regsRead = vx;
+                    p_accesses->regsWritten = 1u << REG_I;
+                    break;
+                case 0x33:
+                    p_accesses->regsRead = vx | 1u << REG_I;
+                    p_accesses->memWriteStart = i;
+                    p_accesses->memWriteEnd = i + 2;
+                    break;
+                case 0x55:
+                    p_accesses->regsRead = v0ToVx | 1u << REG_I;
+                    p_accesses->regsWritten = 1u << REG_I;
+                    p_accesses->memWriteStart = i;
+                    p_accesses->memWriteEnd = i + x;
+                    break;
+                case 0x65:
+                    p_accesses->regsRead = 1u << REG_I;
+                    p_accesses->regsWritten = v0ToVx | 1u << REG_I;
+                    p_accesses->memReadStart = i;
+                    p_accesses->memReadEnd = i + x;
+                    break;
+            }
+            break;
+    }
+}
+
+bool rangesOverlap(uint16_t aStart,
+                   uint16_t aEnd,
+                   uint16_t bStart,
+                   uint16_t bEnd) {
+    return aStart <= aEnd && aStart <= bEnd && bStart <= aEnd;
+}
+
+/// @returns Whether an access range from `Accesses` overlaps a RAM watchpoint
+bool accessOverlaps(uint16_t start, uint16_t end, const Watchpoint* p_watch) {
+    // The part past the end of RAM wraps around to its start
+    if (end >= CORE_RAM_SIZE &&
+        rangesOverlap(0, end - CORE_RAM_SIZE, p_watch->start, p_watch->end))
+        return true;
+    return rangesOverlap(start,
+                         end < CORE_RAM_SIZE ? end : CORE_RAM_SIZE - 1,
+                         p_watch->start,
+                         p_watch->end);
+}
+
+bool conditionHolds(const Condition* p_condition) {
+    if (p_condition->op == OP_NONE) return true;
+
+    uint16_t value = p_condition->isMemory ? readRam(p_condition->operand)
+                                           : readRegister(p_condition->operand);
+    switch (p_condition->op) {
+        case OP_NONE:
+            return true;
+        case OP_EQ:
+            return value == p_condition->value;
+        case OP_NE:
+            return value != p_condition->value;
+        case OP_LT:
+            return value < p_condition->value;
+        case OP_LE:
+            return value <= p_condition->value;
+        case OP_GT:
+            return value > p_condition->value;
+        case OP_GE:
+            return value >= p_condition->value;
+    }
+    return true;
+}
+
+
+/* REPORTING */
+
+const char* registerName(int reg) {
+    static const char* const NAMES[] = {
+        "V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7", "V8", "V9", "VA",
+        "VB", "VC", "VD", "VE", "VF", "I",  "DT", "ST", "SP", "PC",
+    };
+    return NAMES[reg];
+}
+
+void printLocation() {
+    uint16_t pc = gp_debuggee->programCounter;
+    printf("0x%03X: %04X\n", pc, readInstruction(pc));
+}
+
+void printRegisters() {
+    printf("PC: 0x%03X  I: 0x%03X  DT: %u  ST: %u\n",
+           gp_debuggee->programCounter,
+           gp_debuggee->indexReg,
+           gp_debuggee->delayTimer,
+           gp_debuggee->soundTimer);
+    printf("V : ");
+    for (int i = 0; i < 16; i++) printf("%02X ", gp_debuggee->varRegs[i]);
+    printf("\n");
+    printf("Stack (%u): ", gp_debuggee->stackIdx);
+    for (int i = 0; i < gp_debuggee->stackIdx && i < 16; i++)
+        printf("%03X ", gp_debuggee->stack[i]);
+    printf("\n");
+}
+
+
+/* TICKING */
+
+bool checkedTick(MachineState* p_machineState);
+
+/// Executes nothing, for while the machine is stopped
+bool stoppedTick(MachineState*) {
+    g_skippedTicks++;
+    return false;
+}
+
+void updateTickFunction() {
+    if (g_stopped)
+        debugger_tick = &stoppedTick;
+    else
+        debugger_tick = (g_breakpointCount > 0 || g_watchpointCount > 0 ||
+                         g_stepMode != STEP_NONE || g_resumePending)
+                            ? &checkedTick
+                            : &core_tick;
+}
+
+void stop() {
+    g_stopped = true;
+    g_stepMode = STEP_NONE;
+    updateTickFunction();
+    printLocation();
+}
+
+/// @returns Whether a watchpoint was hit
+bool checkWatchpoints(const Accesses* p_accesses) {
+    bool hit = false;
+
+    for (int i = 0; i < g_watchpointCount; i++) {
+        Watchpoint* p_watchpoint = &g_watchpoints[i];
+        bool read, written;
+
+        if (p_watchpoint->isRegister) {
+            uint32_t reg = 1u << p_watchpoint->start;
+            read = p_accesses->regsRead & reg;
+            written = p_accesses->regsWritten & reg;
+        } else {
+            read = accessOverlaps(p_accesses->memReadStart,
+                                  p_accesses->memReadEnd,
+                                  p_watchpoint);
+            written = accessOverlaps(p_accesses->memWriteStart,
+                                     p_accesses->memWriteEnd,
+                                     p_watchpoint);
+        }
+        read = read && (p_watchpoint->mode & WATCH_READ);
+        written = written && (p_watchpoint->mode & WATCH_WRITE);
+
+        if (read || written) {
+            printf("Watchpoint %i %s\n",
+                   p_watchpoint->id,
+                   written ? (read ? "read and written" : "written") : "read");
+            hit = true;
+        }
+    }
+
+    return hit;
+}
+
+bool checkedTick(MachineState* p_machineState) {
+    uint16_t pc = p_machineState->programCounter;
+
+    // Don't stop again at the breakpoint being resumed from
+    bool resuming = g_resumePending && pc == g_resumeAddr;
+    g_resumePending = false;
+    if (!resuming && isBreakpoint(pc)) {
+        Breakpoint* p_breakpoint = findBreakpoint(pc);
+        if (conditionHolds(&p_breakpoint->condition)) {
+            printf("Breakpoint %i\n", p_breakpoint->id);
+            stop();
+            // The instruction at the breakpoint is executed on resuming
+            g_skippedTicks++;
+            return false;
+        }
+    }
+
+    // Breakpoints and stepping don't need the accesses decoded
+    Accesses accesses;
+    if (g_watchpointCount > 0) decodeAccesses(readInstruction(pc), &accesses);
+
+    bool updatedDisp = core_tick(p_machineState);
+
+    // The instruction faulted
+    if (g_stopped) {
+        updateTickFunction();
+        return updatedDisp;
+    }
+
+    bool stepDone = false;
+    switch (g_stepMode) {
+        case STEP_NONE:
+            break;
+        case STEP_INTO:
+            stepDone = true;
+            break;
+        case STEP_OVER:
+            stepDone = p_machineState->programCounter == g_stepTarget &&
+                       p_machineState->stackIdx == g_stepDepth;
+            break;
+        case STEP_OUT:
+            stepDone = p_machineState->stackIdx < g_stepDepth;
+            break;
+    }
+
+    if ((g_watchpointCount > 0 && checkWatchpoints(&accesses)) || stepDone)
+        stop();
+    updateTickFunction();
+
+    return updatedDisp;
+}
+
+
+/* CONTROL */
+
+void debugger_trap() {
+    if (gp_debuggee == NULL) return;
+
+    uint16_t addr = (gp_debuggee->programCounter - 2) % CORE_RAM_SIZE;
+    if (gp_debuggee->fault == CORE_FAULT_STACK_OVERFLOW ||
+        gp_debuggee->fault == CORE_FAULT_STACK_UNDERFLOW)
+        printf("Stack %s at 0x%03X\n",
+               gp_debuggee->fault == CORE_FAULT_STACK_OVERFLOW ? "overflow"
+                                                              : "underflow",
+               addr);
+    else
+        printf("Illegal instruction at 0x%03X\n", addr);
+    stop();
+}
+
+bool debugger_isStopped() { return g_stopped; }
+
+uint64_t debugger_takeSkippedTicks() {
+    uint64_t skippedTicks = g_skippedTicks;
+    g_skippedTicks = 0;
+    return skippedTicks;
+}
+
+/// Resumes the machine, stepping over the breakpoint it is stopped at if any
+void resume(StepMode stepMode) {
+    g_stopped = false;
+    g_stepMode = stepMode;
+
+    uint16_t pc = gp_debuggee->programCounter;
+    if (isBreakpoint(pc)) {
+        g_resumePending = true;
+        g_resumeAddr = pc;
+    }
+
+    updateTickFunction();
+}
+
+
+/* CONSOLE */
+
+/// @returns A register number, or -1 if `p_name` isn't a register
+int parseRegister(const char* p_name) {
+    for (int reg = 0; reg <= REG_PC; reg++)
+        if (strcasecmp(p_name, registerName(reg)) == 0) return reg;
+    return -1;
+}
+
+bool parseNumber(const char* p_str, long* p_value) {
+    if (p_str == NULL) return false;
+
+    char* p_end;
+    *p_value = strtol(p_str, &p_end, 0);
+    return *p_str != '\0' && *p_end == '\0';
+}
+
+/// Parses `REG op value` or `[addr] op value`
+bool parseCondition(char* p_tokens[3], Condition* p_condition) {
+    static const char* const OPS[] = {"", "==", "!=", "<", "<=", ">", ">="};
+
+    *p_condition = (Condition){};
+    if (p_tokens[0] == NULL || p_tokens[1] == NULL) return false;
+
+    long value;
+    size_t len = strlen(p_tokens[0]);
+    if (p_tokens[0][0] == '[' && p_tokens[0][len - 1] == ']') {
+        p_tokens[0][len - 1] = '\0';
+        if (!parseNumber(&p_tokens[0][1], &value) || value < 0 ||
+            value >= CORE_RAM_SIZE)
+            return false;
+        p_condition->isMemory = true;
+        p_condition->operand = value;
+    } else {
+        int reg = parseRegister(p_tokens[0]);
+        if (reg < 0) return false;
+        p_condition->operand = reg;
+    }
+
+    for (int op = OP_EQ; op <= OP_GE; op++)
+        if (strcmp(p_tokens[1], OPS[op]) == 0) p_condition->op = op;
+    if (p_condition->op == OP_NONE) return false;
+
+    if (!parseNumber(p_tokens[2], &value)) return false;
+    p_condition->value = value;
+
+    return true;
+}
+
+void addBreakpoint(char* p_tokens[]) {
+    long addr;
+    if (!parseNumber(p_tokens[1], &addr) || addr < 0 ||
+        addr > CORE_RAM_SIZE - 2) {
+        printf("Usage: b ADDR [if REG|[ADDR] OP VALUE]\n");
+        return;
+    }
+    if (findBreakpoint(addr) != NULL) {
+        printf("A breakpoint is already at 0x%03lX\n", addr);
+        return;
+    }
+    if (g_breakpointCount == MAX_BREAKPOINTS) {
+        printf("Too many breakpoints\n");
+        return;
+    }
+
+    Breakpoint breakpoint = {.addr = addr};
+    if (p_tokens[2] != NULL &&
+        (strcmp(p_tokens[2], "if") != 0 ||
+         !parseCondition(&p_tokens[3], &breakpoint.condition))) {
+        printf("Conditions look like `V3 == 5` or `[0x300] >= 0x10`\n");
+        return;
+    }
+
+    breakpoint.id = g_nextId++;
+    g_breakpoints[g_breakpointCount++] = breakpoint;
+    updateBreakpointMap();
+    updateTickFunction();
+
+    printf("Breakpoint %i at 0x%03lX\n", breakpoint.id, addr);
+}
+
+void addWatchpoint(char* p_tokens[]) {
+    Watchpoint watchpoint = {.mode = WATCH_WRITE};
+
+    long start, len = 1;
+    int reg = p_tokens[1] != NULL ? parseRegister(p_tokens[1]) : -1;
+    if (reg >= 0 && reg < WATCHABLE_REGS) {
+        watchpoint.isRegister = true;
+        watchpoint.start = reg;
+    } else {
+        char* p_len = p_tokens[1] != NULL ? strchr(p_tokens[1], ':') : NULL;
+        if (p_len != NULL) *(p_len++) = '\0';
+        if (!parseNumber(p_tokens[1], &start) ||
+            (p_len != NULL && !parseNumber(p_len, &len)) || start < 0 ||
+            len < 1 || start + len > CORE_RAM_SIZE) {
+            printf("Usage: w ADDR[:LEN]|REG [r|w|rw]\n");
+            return;
+        }
+        watchpoint.start = start;
+        watchpoint.end = start + len - 1;
+    }
+
+    if (p_tokens[2] != NULL) {
+        watchpoint.mode = 0;
+        if (strchr(p_tokens[2], 'r')) watchpoint.mode |= WATCH_READ;
+        if (strchr(p_tokens[2], 'w')) watchpoint.mode |= WATCH_WRITE;
+    }
+    if (watchpoint.mode == 0 || g_watchpointCount == MAX_WATCHPOINTS) {
+        printf("Usage: w ADDR[:LEN]|REG [r|w|rw]\n");
+        return;
+    }
+
+    watchpoint.id = g_nextId++;
+    g_watchpoints[g_watchpointCount++] = watchpoint;
+    updateTickFunction();
+
+    printf("Watchpoint %i\n", watchpoint.id);
+}
+
+void deletePoint(char* p_tokens[]) {
+    long id;
+    if (!parseNumber(p_tokens[1], &id)) {
+        printf("Usage: d ID\n");
+        return;
+    }
+
+    for (int i = 0; i < g_breakpointCount; i++)
+        if (g_breakpoints[i].id == id) {
+            g_breakpoints[i] = g_breakpoints[--g_breakpointCount];
+            updateBreakpointMap();
+            // Nothing left to step over
+            if (g_resumePending && findBreakpoint(g_resumeAddr) == NULL)
+                g_resumePending = false;
+            updateTickFunction();
+            return;
+        }
+
+    for (int i = 0; i < g_watchpointCount; i++)
+        if (g_watchpoints[i].id == id) {
+            g_watchpoints[i] = g_watchpoints[--g_watchpointCount];
+            updateTickFunction();
+            return;
+        }
+
+    printf("No breakpoint or watchpoint %li\n", id);
+}
+
+void listPoints() {
+    for (int i = 0; i < g_breakpointCount; i++)
+        printf("%i: breakpoint at 0x%03X%s\n",
+               g_breakpoints[i].id,
+               g_breakpoints[i].addr,
+               g_breakpoints[i].condition.op != OP_NONE ? " (conditional)"
+                                                        : "");
+
+    for (int i = 0; i < g_watchpointCount; i++) {
+        Watchpoint* p_watchpoint = &g_watchpoints[i];
+        const char* p_mode = p_watchpoint->mode == WATCH_READ    ? "r"
+                             : p_watchpoint->mode == WATCH_WRITE ? "w"
+                                                                 : "rw";
+        if (p_watchpoint->isRegister)
+            printf("%i: watchpoint on %s (%s)\n",
+                   p_watchpoint->id,
+                   registerName(p_watchpoint->start),
+                   p_mode);
+        else
+            printf("%i: watchpoint on 0x%03X-0x%03X (%s)\n",
+                   p_watchpoint->id,
+                   p_watchpoint->start,
+                   p_watchpoint->end,
+                   p_mode);
+    }
+}
+
+void dumpRam(char* p_tokens[]) {
+    long addr, len = 16;
+    if (!parseNumber(p_tokens[1], &addr) ||
+        (p_tokens[2] != NULL && !parseNumber(p_tokens[2], &len))) {
+        printf("Usage: x ADDR [LEN]\n");
+        return;
+    }
+
+    for (long i = 0; i < len; i++) {
+        if (i % 16 == 0) printf("%s%04lX: ", i ? "\n" : "", addr + i);
+        printf("%02X ", readRam(addr + i));
+    }
+    printf("\n");
+}
+
+void printHelp() {
+    printf(
+        "b ADDR [if COND]      Break at ADDR, optionally only when COND holds\n"
+        "                      e.g. `b 0x2A4 if V3 == 5` or `if [0x3F0] > 2`\n"
+        "w ADDR[:LEN] [r|w|rw] Watch LEN bytes of RAM for reads and/or writes\n"
+        "w REG [r|w|rw]        Watch V0-VF, I, DT or ST\n"
+        "d ID                  Delete a breakpoint or watchpoint\n"
+        "l                     List breakpoints and watchpoints\n"
+        "c                     Continue\n"
+        "s                     Step one instruction\n"
+        "n                     Step over subroutine calls\n"
+        "f                     Step out of the current subroutine\n"
+        "h                     Halt the machine\n"
+        "p                     Print registers\n"
+        "x ADDR [LEN]          Dump RAM\n");
+}
+
+void runCommand(char* p_line) {
+    char* p_tokens[8] = {};
+    int count = 0;
+    for (char* p_token = strtok(p_line, " \t");
+         p_token != NULL && count < 7;
+         p_token = strtok(NULL, " \t"))
+        p_tokens[count++] = p_token;
+    if (count == 0) return;
+
+    const char* p_command = p_tokens[0];
+    bool needsStop = strcmp(p_command, "s") == 0 ||
+                     strcmp(p_command, "n") == 0 ||
+                     strcmp(p_command, "f") == 0 || strcmp(p_command, "c") == 0;
+    if (needsStop && !g_stopped) {
+        printf("The machine is running, halt it first with `h`\n");
+        return;
+    }
+
+    if (strcmp(p_command, "b") == 0) {
+        addBreakpoint(p_tokens);
+    } else if (strcmp(p_command, "w") == 0) {
+        addWatchpoint(p_tokens);
+    } else if (strcmp(p_command, "d") == 0) {
+        deletePoint(p_tokens);
+    } else if (strcmp(p_command, "l") == 0) {
+        listPoints();
+    } else if (strcmp(p_command, "c") == 0) {
+        resume(STEP_NONE);
+    } else if (strcmp(p_command, "s") == 0) {
+        resume(STEP_INTO);
+    } else if (strcmp(p_command, "n") == 0) {
+        uint16_t pc = gp_debuggee->programCounter;
+        if ((readInstruction(pc) >> 12) == 0x2) {
+            g_stepTarget = pc + 2;
+            g_stepDepth = gp_debuggee->stackIdx;
+            resume(STEP_OVER);
+        } else {
+            resume(STEP_INTO);
+        }
+    } else if (strcmp(p_command, "f") == 0) {
+        if (gp_debuggee->stackIdx == 0) {
+            printf("Not in a subroutine\n");
+            return;
+        }
+        g_stepDepth = gp_debuggee->stackIdx;
+        resume(STEP_OUT);
+    } else if (strcmp(p_command, "h") == 0) {
+        if (!g_stopped) stop();
+    } else if (strcmp(p_command, "p") == 0) {
+        printRegisters();
+    } else if (strcmp(p_command, "x") == 0) {
+        dumpRam(p_tokens);
+    } else {
+        printHelp();
+    }
+}
+
+void debugger_attach(MachineState* p_machineState) {
+    gp_debuggee = p_machineState;
+    printf("Debugger attached, type `help` for commands\n");
+}
+
+void debugger_poll() {
+    if (gp_debuggee == NULL || g_consoleClosed) return;
+
+    struct pollfd stdinPoll = {.fd = STDIN_FILENO, .events = POLLIN};
+    while (poll(&stdinPoll, 1, 0) > 0) {
+        ssize_t count = read(STDIN_FILENO,
+                             &g_consoleLine[g_consoleLineLen],
+                             CONSOLE_LINE_LEN - 1 - g_consoleLineLen);
+        if (count <= 0) {
+            g_consoleClosed = true;
+            return;
+        }
+        g_consoleLineLen += count;
+
+        char* p_newline;
+        while ((p_newline = memchr(g_consoleLine, '\n', g_consoleLineLen))) {
+            *p_newline = '\0';
+            runCommand(g_consoleLine);
+
+            size_t lineLen = p_newline + 1 - g_consoleLine;
+            memmove(g_consoleLine,
+                    p_newline + 1,
+                    g_consoleLineLen - lineLen);
+            g_consoleLineLen -= lineLen;
+        }
+
+        // Drop lines that are too long to be commands
+        if (g_consoleLineLen == CONSOLE_LINE_LEN - 1) g_consoleLineLen = 0;
+    }
+
+    fflush(stdout);
+}
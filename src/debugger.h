@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+
+/**
+ * Executes a single instruction of the attached machine.
+ *
+ * Points to `core_tick` until a breakpoint or watchpoint is set or the
+ * debugger is stepping, so that an attached debugger without any costs nothing
+ * per instruction. Breakpoints are kept out of RAM, where the program could
+ * see or overwrite them. While the machine is stopped, this executes nothing.
+ *
+ * @see `core_tick`
+ */
+extern bool (*debugger_tick)(MachineState* p_machineState);
+
+/**
+ * Attaches the debugger console on stdin to `p_machineState`.
+ *
+ * Type `help` into the console for a list of commands.
+ *
+ * @param p_machineState    The machine to debug
+ */
+void debugger_attach(MachineState* p_machineState);
+
+/**
+ * Reports a fault of the machine and stops it.
+ *
+ * Should be called from the `sigIllHandler` callback of the attached machine.
+ */
+void debugger_trap();
+
+/// @returns Whether the attached machine is stopped in the debugger
+bool debugger_isStopped();
+
+/**
+ * @returns How many calls to `debugger_tick` executed nothing because the
+ *          machine was stopped, since the last call. The caller can execute
+ *          them once the machine resumes.
+ */
+uint64_t debugger_takeSkippedTicks();
+
+/// Executes any commands typed into the console, without blocking
+void debugger_poll();
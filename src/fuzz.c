@@ -0,0 +1,463 @@
+/*
+ * Coverage guided input fuzzer.
+ *
+ * Runs a ROM under mutated, timed key sequences on every core, looking for
+ * illegal instructions and stack overflows/underflows. Each thread owns a
+ * libcchip8 environment that is reset from an in-memory snapshot before every
+ * run, and records the branch edges taken into a bitmap. Inputs that reach
+ * new edges (or new hit counts of an edge) are kept in a shared corpus to be
+ * mutated further.
+ *
+ * Every distinct fault (kind and address) is saved to the output directory as
+ * an input movie of the frames up to the fault, which `cchip8-replay` can
+ * seek through and verify.
+ */
+
+// For `sysconf`
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcchip8.h"
+#include "movie.h"
+
+#define VERSION "0.1.0"
+#define PROG_NAME "cchip8-fuzz"
+
+
+#define COVERAGE_SIZE (1 << 16)
+#define MAX_INPUT_EVENTS 64
+#define MAX_CORPUS_SIZE 4096
+#define MAX_EVENT_FRAMES 60
+// How many mutations are stacked onto each input at most
+#define MAX_STACKED_MUTATIONS 4
+#define KEYFRAME_INTERVAL 600
+
+
+/// Keys held for a number of frames
+typedef struct KeyEvent {
+    uint16_t frames;
+    uint16_t keys;
+} KeyEvent;
+
+typedef struct Input {
+    KeyEvent events[MAX_INPUT_EVENTS];
+    size_t eventCount;
+} Input;
+
+
+/* OPTIONS */
+
+uint8_t g_rom[CCHIP8_MAX_ROM_SIZE];
+size_t g_romSize = 0;
+uint32_t g_instructionsPerFrame = 8;
+uint32_t g_seed = 1;
+uint64_t g_maxFrames = 600;
+const char* gp_outDir = ".";
+
+
+/* SHARED STATE */
+
+// The hit count buckets seen so far for every edge
+_Atomic uint8_t g_virginCoverage[COVERAGE_SIZE];
+
+pthread_mutex_t g_corpusMutex = PTHREAD_MUTEX_INITIALIZER;
+Input g_corpus[MAX_CORPUS_SIZE];
+size_t g_corpusSize = 0;
+
+// One bit for every fault kind and address, so each is only saved once
+_Atomic uint64_t g_seenFaults[4 * 4096 / 64];
+atomic_uint_fast64_t g_faultCount = 0;
+
+atomic_uint_fast64_t g_execs = 0;
+atomic_bool g_stopping = false;
+
+
+/* RANDOMNESS */
+
+uint64_t nextRandom64(uint64_t* p_state) {
+    uint64_t x = *p_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *p_state = x;
+    return x;
+}
+
+/// @returns A random number in [0, bound)
+uint64_t randomBelow(uint64_t* p_state, uint64_t bound) {
+    return nextRandom64(p_state) % bound;
+}
+
+uint16_t randomKeys(uint64_t* p_state) {
+    // Games mostly look at one key at a time
+    switch (randomBelow(p_state, 4)) {
+        case 0:
+            return 0;
+        case 1:
+            return nextRandom64(p_state);
+        default:
+            return 1u << randomBelow(p_state, 16);
+    }
+}
+
+
+/* MUTATION */
+
+void mutate(Input* p_input, uint64_t* p_rng) {
+    int mutations = 1 + randomBelow(p_rng, MAX_STACKED_MUTATIONS);
+
+    for (int m = 0; m < mutations; m++) {
+        size_t count = p_input->eventCount;
+        size_t idx = count > 0 ? randomBelow(p_rng, count) : 0;
+        KeyEvent* p_event = &p_input->events[idx];
+
+        switch (count > 0 ? randomBelow(p_rng, 6) : 3) {
+            case 0:
+                p_event->keys ^= 1u << randomBelow(p_rng, 16);
+                break;
+
+            case 1:
+                p_event->keys = randomKeys(p_rng);
+                break;
+
+            case 2:
+                p_event->frames = 1 + randomBelow(p_rng, MAX_EVENT_FRAMES);
+                break;
+
+            case 3:
+                if (count == MAX_INPUT_EVENTS) break;
+                if (count > 0) idx = randomBelow(p_rng, count + 1);
+                memmove(&p_input->events[idx + 1],
+                        &p_input->events[idx],
+                        (count - idx) * sizeof(KeyEvent));
+                p_input->events[idx] = (KeyEvent){
+                    .frames = 1 + randomBelow(p_rng, MAX_EVENT_FRAMES),
+                    .keys = randomKeys(p_rng),
+                };
+                p_input->eventCount++;
+                break;
+
+            case 4:
+                memmove(&p_input->events[idx],
+                        &p_input->events[idx + 1],
+                        (count - idx - 1) * sizeof(KeyEvent));
+                p_input->eventCount--;
+                break;
+
+            case 5: {
+                // Splice the tail of another input onto this one
+                pthread_mutex_lock(&g_corpusMutex);
+                if (g_corpusSize > 0) {
+                    const Input* p_other =
+                        &g_corpus[randomBelow(p_rng, g_corpusSize)];
+                    size_t start = randomBelow(p_rng, p_other->eventCount + 1);
+                    size_t tailLen = p_other->eventCount - start;
+                    if (idx + tailLen > MAX_INPUT_EVENTS)
+                        tailLen = MAX_INPUT_EVENTS - idx;
+                    memcpy(&p_input->events[idx],
+                           &p_other->events[start],
+                           tailLen * sizeof(KeyEvent));
+                    p_input->eventCount = idx + tailLen;
+                }
+                pthread_mutex_unlock(&g_corpusMutex);
+                break;
+            }
+        }
+    }
+}
+
+
+/* COVERAGE */
+
+/// Groups hit counts like AFL, so loops only count when they change magnitude
+uint8_t bucket(uint8_t count) {
+    if (count <= 3) return 1u << (count - 1);
+    if (count <= 7) return 1u << 3;
+    if (count <= 15) return 1u << 4;
+    if (count <= 31) return 1u << 5;
+    if (count <= 127) return 1u << 6;
+    return 1u << 7;
+}
+
+/// @returns Whether `p_trace` reached an edge or hit count bucket for the
+/// first time, which is then marked as seen
+bool mergeCoverage(const uint8_t* p_trace) {
+    bool isNew = false;
+
+    const uint64_t* p_words = (const uint64_t*)p_trace;
+    for (size_t word = 0; word < COVERAGE_SIZE / 8; word++) {
+        if (p_words[word] == 0) continue;
+
+        for (size_t i = word * 8; i < word * 8 + 8; i++) {
+            if (p_trace[i] == 0) continue;
+
+            uint8_t bits = bucket(p_trace[i]);
+            if ((atomic_load_explicit(&g_virginCoverage[i],
+                                      memory_order_relaxed) &
+                 bits) == 0 &&
+                (atomic_fetch_or(&g_virginCoverage[i], bits) & bits) == 0)
+                isNew = true;
+        }
+    }
+
+    return isNew;
+}
+
+size_t coveredEdges() {
+    size_t edges = 0;
+    for (size_t i = 0; i < COVERAGE_SIZE; i++)
+        if (atomic_load_explicit(&g_virginCoverage[i], memory_order_relaxed))
+            edges++;
+    return edges;
+}
+
+
+/* FAULTS */
+
+const char* faultName(Cchip8Fault fault) {
+    switch (fault) {
+        case CCHIP8_FAULT_NONE:
+            return "none";
+        case CCHIP8_FAULT_ILLEGAL_INSTRUCTION:
+            return "illegal";
+        case CCHIP8_FAULT_STACK_OVERFLOW:
+            return "overflow";
+        case CCHIP8_FAULT_STACK_UNDERFLOW:
+            return "underflow";
+    }
+    return "unknown";
+}
+
+void saveFault(const Input* p_input,
+               uint64_t frames,
+               Cchip8Fault fault,
+               uint16_t addr) {
+    size_t bit = fault * 4096 + addr % 4096;
+    uint64_t mask = 1ull << (bit % 64);
+    if (atomic_fetch_or(&g_seenFaults[bit / 64], mask) & mask) return;
+    atomic_fetch_add(&g_faultCount, 1);
+
+    char path[4096];
+    snprintf(path,
+             sizeof(path),
+             "%s/%s-%03X.c8m",
+             gp_outDir,
+             faultName(fault),
+             addr);
+
+    // Replay the frames up to the fault on a fresh environment to record them
+    Cchip8Envs* p_envs = cchip8_create(
+        1, g_rom, g_romSize, g_instructionsPerFrame, NULL, 0);
+    Movie movie;
+    if (p_envs == NULL) {
+        fprintf(stderr, "Couldn't save fault\n");
+        return;
+    }
+    cchip8_seed(p_envs, 0, g_seed);
+    bool saved = movie_startRecording(&movie,
+                                      p_envs,
+                                      0,
+                                      g_instructionsPerFrame * 60,
+                                      g_seed,
+                                      KEYFRAME_INTERVAL);
+    for (size_t i = 0; saved && i < p_input->eventCount && frames > 0; i++)
+        for (uint16_t f = 0;
+             saved && f < p_input->events[i].frames && frames > 0;
+             f++, frames--) {
+            cchip8_stepOne(p_envs, 0, p_input->events[i].keys);
+            saved = movie_recordFrame(
+                &movie, p_envs, 0, p_input->events[i].keys);
+        }
+    if (saved) {
+        saved = movie_save(&movie, path);
+        movie_free(&movie);
+    }
+    cchip8_destroy(p_envs);
+    if (!saved) {
+        fprintf(stderr, "Couldn't save fault to %s\n", path);
+        return;
+    }
+
+    printf("\nFound %s at 0x%03X, saved to %s\n",
+           fault == CCHIP8_FAULT_ILLEGAL_INSTRUCTION ? "illegal instruction"
+           : fault == CCHIP8_FAULT_STACK_OVERFLOW    ? "stack overflow"
+                                                     : "stack underflow",
+           addr,
+           path);
+}
+
+
+/* FUZZING */
+
+void addToCorpus(const Input* p_input) {
+    pthread_mutex_lock(&g_corpusMutex);
+    if (g_corpusSize < MAX_CORPUS_SIZE) g_corpus[g_corpusSize++] = *p_input;
+    pthread_mutex_unlock(&g_corpusMutex);
+}
+
+void pickFromCorpus(Input* p_input, uint64_t* p_rng) {
+    pthread_mutex_lock(&g_corpusMutex);
+    if (g_corpusSize > 0)
+        *p_input = g_corpus[randomBelow(p_rng, g_corpusSize)];
+    else
+        p_input->eventCount = 0;
+    pthread_mutex_unlock(&g_corpusMutex);
+}
+
+void* fuzzWorker(void* p_arg) {
+    uint64_t rng = (uintptr_t)p_arg * 0x9E3779B97F4A7C15ull + time(NULL);
+    if (rng == 0) rng = 1;
+
+    uint8_t* p_trace = calloc(COVERAGE_SIZE, 1);
+    Cchip8Envs* p_envs = cchip8_create(
+        1, g_rom, g_romSize, g_instructionsPerFrame, NULL, 0);
+    void* p_snapshot = malloc(cchip8_stateSize());
+    if (p_trace == NULL || p_envs == NULL || p_snapshot == NULL) {
+        fprintf(stderr, "Couldn't create fuzzing environment\n");
+        return NULL;
+    }
+    cchip8_seed(p_envs, 0, g_seed);
+    cchip8_setCoverage(p_envs, 0, p_trace, COVERAGE_SIZE);
+    cchip8_saveState(p_envs, 0, p_snapshot);
+
+    Input input;
+    while (!atomic_load_explicit(&g_stopping, memory_order_relaxed)) {
+        pickFromCorpus(&input, &rng);
+        mutate(&input, &rng);
+
+        cchip8_loadState(p_envs, 0, p_snapshot);
+        memset(p_trace, 0, COVERAGE_SIZE);
+
+        uint64_t frames = 0;
+        Cchip8Fault fault = CCHIP8_FAULT_NONE;
+        for (size_t i = 0; i < input.eventCount && frames < g_maxFrames &&
+                           fault == CCHIP8_FAULT_NONE;
+             i++)
+            for (uint16_t f = 0; f < input.events[i].frames &&
+                                 frames < g_maxFrames &&
+                                 fault == CCHIP8_FAULT_NONE;
+                 f++) {
+                cchip8_stepOne(p_envs, 0, input.events[i].keys);
+                frames++;
+                fault = cchip8_fault(p_envs, 0, NULL);
+            }
+
+        if (mergeCoverage(p_trace)) addToCorpus(&input);
+        if (fault != CCHIP8_FAULT_NONE) {
+            uint16_t addr;
+            cchip8_fault(p_envs, 0, &addr);
+            saveFault(&input, frames, fault, addr);
+        }
+
+        atomic_fetch_add_explicit(&g_execs, 1, memory_order_relaxed);
+    }
+
+    free(p_snapshot);
+    free(p_trace);
+    cchip8_destroy(p_envs);
+    return NULL;
+}
+
+
+/* MAIN */
+
+void printUsage() {
+    printf("Usage: %s [options] rom_file\n", PROG_NAME);
+    printf("  -j threads    Fuzzing threads, defaults to one per core\n");
+    printf("  -t seconds    Stop after this long, defaults to running "
+           "forever\n");
+    printf("  -n frames     Maximum frames per run, defaults to 600\n");
+    printf("  -i ipf        Instructions per frame, defaults to 8\n");
+    printf("  -s seed       Random number generator seed, defaults to 1\n");
+    printf("  -o directory  Where to save faults, defaults to .\n");
+}
+
+int main(int argc, char* p_argv[]) {
+    printf("%s version %s\n\n", PROG_NAME, VERSION);
+
+    long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t duration = 0;
+    int opt;
+    while ((opt = getopt(argc, p_argv, "j:t:n:i:s:o:")) != -1) {
+        switch (opt) {
+            case 'j':
+                threadCount = strtol(optarg, NULL, 0);
+                break;
+            case 't':
+                duration = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                g_maxFrames = strtoull(optarg, NULL, 0);
+                break;
+            case 'i':
+                g_instructionsPerFrame = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                g_seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                gp_outDir = optarg;
+                break;
+            default:
+                printUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || threadCount < 1 || g_maxFrames == 0 ||
+        g_seed == 0) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    if (!cchip8_loadRom(p_argv[optind], g_rom, &g_romSize)) {
+        fprintf(stderr, "ROM file could not be opened\n");
+        return EXIT_FAILURE;
+    }
+
+    if (mkdir(gp_outDir, 0755) < 0 && errno != EEXIST) {
+        perror("Couldn't create output directory");
+        return EXIT_FAILURE;
+    }
+
+    pthread_t* p_threads = calloc(threadCount, sizeof(*p_threads));
+    if (p_threads == NULL) return EXIT_FAILURE;
+    for (long i = 0; i < threadCount; i++)
+        pthread_create(&p_threads[i], NULL, &fuzzWorker, (void*)(i + 1));
+
+    uint64_t previousExecs = 0;
+    for (uint64_t seconds = 1; duration == 0 || seconds <= duration;
+         seconds++) {
+        sleep(1);
+
+        uint64_t execs = atomic_load(&g_execs);
+        pthread_mutex_lock(&g_corpusMutex);
+        size_t corpusSize = g_corpusSize;
+        pthread_mutex_unlock(&g_corpusMutex);
+
+        printf("\r%lu s: %lu execs/s, %lu execs, %zu edges, %zu inputs, "
+               "%lu faults   ",
+               seconds,
+               execs - previousExecs,
+               execs,
+               coveredEdges(),
+               corpusSize,
+               (uint64_t)atomic_load(&g_faultCount));
+        fflush(stdout);
+        previousExecs = execs;
+    }
+
+    atomic_store(&g_stopping, true);
+    for (long i = 0; i < threadCount; i++) pthread_join(p_threads[i], NULL);
+    printf("\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,502 @@
+#include "libcchip8.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytes.h"
+#include "core.h"
+
+
+#define ROM_ADDR 0x0200
+
+// How many chunks each worker gets per step, more chunks balance better when
+// some environments take longer than others
+#define CHUNKS_PER_THREAD 4
+
+static_assert((int)CCHIP8_FAULT_STACK_UNDERFLOW ==
+                  (int)CORE_FAULT_STACK_UNDERFLOW,
+              "Cchip8Fault must mirror CoreFault");
+static_assert(CCHIP8_MAX_ROM_SIZE == CORE_RAM_SIZE - ROM_ADDR,
+              "ROMs must fit in RAM after 0x0200");
+
+
+typedef struct Env {
+    MachineState machineState;
+    /// Points into the framebuffers of the batch
+    uint64_t* p_display;
+    uint16_t heldKeys;
+
+    /// Latched until the environment is reset or loaded
+    CoreFault fault;
+    uint16_t faultAddr;
+
+    /// NULL when coverage isn't being recorded
+    uint8_t* p_coverage;
+    size_t coverageMask;
+} Env;
+
+typedef struct State {
+    MachineState machineState;
+    uint64_t display[32];
+} State;
+
+struct Cchip8Envs {
+    Env* p_envs;
+    size_t count;
+    uint32_t instructionsPerFrame;
+
+    uint8_t rom[CCHIP8_MAX_ROM_SIZE];
+    size_t romSize;
+
+    uint64_t* p_framebuffers;
+    bool ownsFramebuffers;
+
+    /* THREAD POOL */
+
+    pthread_t* p_threads;
+    size_t threadCount;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t startCond;
+    pthread_cond_t doneCond;
+    /// Incremented for every step, tells the workers there is new work
+    uint64_t generation;
+    /// The number of workers that haven't finished the current step
+    size_t busyWorkers;
+    bool stopping;
+
+    const uint16_t* p_keyMasks;
+    size_t chunkSize;
+    atomic_size_t nextChunk;
+};
+
+
+/* CORE CALLBACKS */
+
+// The environment being stepped on this thread
+static thread_local Env* gp_currentEnv = NULL;
+
+static uint16_t heldKeys() { return gp_currentEnv->heldKeys; }
+
+static bool getPixel(uint8_t x, uint8_t y) {
+    return gp_currentEnv->p_display[y % 32] >> (63 - x % 64) & 0b1;
+}
+static void togglePixel(uint8_t x, uint8_t y) {
+    gp_currentEnv->p_display[y % 32] ^= 1ull << (63 - x % 64);
+}
+static void clearDisplay() {
+    memset(gp_currentEnv->p_display, 0, 32 * sizeof(uint64_t));
+}
+
+static void sigIllHandler() {
+    Env* p_env = gp_currentEnv;
+    if (p_env->fault != CORE_FAULT_NONE) return;
+
+    p_env->fault = p_env->machineState.fault;
+    p_env->faultAddr = p_env->machineState.programCounter - 2;
+}
+
+
+/* STEPPING */
+
+// Mixes the edge into the upper bits, which index the bitmap after masking
+static inline size_t edgeIndex(uint16_t from, uint16_t to, size_t mask) {
+    uint32_t edge = (uint32_t)(from % CORE_RAM_SIZE) << 16 | to % CORE_RAM_SIZE;
+    return (edge * 2654435761u ^ (edge * 2654435761u) >> 16) & mask;
+}
+
+static void stepEnv(Env* p_env, uint16_t keyMask, uint32_t instructions) {
+    gp_currentEnv = p_env;
+    p_env->heldKeys = keyMask;
+    MachineState* p_machineState = &p_env->machineState;
+
+    // Keep the recording out of the common loop
+    if (p_env->p_coverage == NULL) {
+        for (uint32_t i = 0; i < instructions && !p_env->fault; i++)
+            core_tick(p_machineState);
+    } else {
+        for (uint32_t i = 0; i < instructions && !p_env->fault; i++) {
+            uint16_t from = p_machineState->programCounter;
+            core_tick(p_machineState);
+
+            uint8_t* p_count =
+                &p_env->p_coverage[edgeIndex(from,
+                                             p_machineState->programCounter,
+                                             p_env->coverageMask)];
+            if (*p_count < 255) (*p_count)++;
+        }
+    }
+    core_timerTick(p_machineState);
+}
+
+// Steps chunks of environments until there are none left
+static void stepChunks(Cchip8Envs* p_envs) {
+    while (true) {
+        size_t start = atomic_fetch_add_explicit(
+                           &p_envs->nextChunk, 1, memory_order_relaxed) *
+                       p_envs->chunkSize;
+        if (start >= p_envs->count) return;
+
+        size_t end = start + p_envs->chunkSize;
+        if (end > p_envs->count) end = p_envs->count;
+        for (size_t i = start; i < end; i++)
+            stepEnv(&p_envs->p_envs[i],
+                    p_envs->p_keyMasks[i],
+                    p_envs->instructionsPerFrame);
+    }
+}
+
+static void* worker(void* p_arg) {
+    Cchip8Envs* p_envs = p_arg;
+    uint64_t seenGeneration = 0;
+
+    pthread_mutex_lock(&p_envs->mutex);
+    while (true) {
+        while (p_envs->generation == seenGeneration && !p_envs->stopping)
+            pthread_cond_wait(&p_envs->startCond, &p_envs->mutex);
+        if (p_envs->stopping) break;
+        seenGeneration = p_envs->generation;
+        pthread_mutex_unlock(&p_envs->mutex);
+
+        stepChunks(p_envs);
+
+        pthread_mutex_lock(&p_envs->mutex);
+        if (--p_envs->busyWorkers == 0)
+            pthread_cond_signal(&p_envs->doneCond);
+    }
+    pthread_mutex_unlock(&p_envs->mutex);
+
+    return NULL;
+}
+
+void cchip8_step(Cchip8Envs* p_envs, const uint16_t* p_keyMasks) {
+    p_envs->p_keyMasks = p_keyMasks;
+    atomic_store_explicit(&p_envs->nextChunk, 0, memory_order_relaxed);
+
+    if (p_envs->threadCount == 0) {
+        stepChunks(p_envs);
+        return;
+    }
+
+    pthread_mutex_lock(&p_envs->mutex);
+    p_envs->generation++;
+    p_envs->busyWorkers = p_envs->threadCount;
+    pthread_cond_broadcast(&p_envs->startCond);
+    pthread_mutex_unlock(&p_envs->mutex);
+
+    // Help out instead of idling
+    stepChunks(p_envs);
+
+    pthread_mutex_lock(&p_envs->mutex);
+    while (p_envs->busyWorkers > 0)
+        pthread_cond_wait(&p_envs->doneCond, &p_envs->mutex);
+    pthread_mutex_unlock(&p_envs->mutex);
+}
+
+void cchip8_setCoverage(Cchip8Envs* p_envs,
+                        size_t env,
+                        uint8_t* p_bitmap,
+                        size_t bitmapSize) {
+    p_envs->p_envs[env].p_coverage = p_bitmap;
+    p_envs->p_envs[env].coverageMask = bitmapSize - 1;
+}
+
+void cchip8_stepOne(Cchip8Envs* p_envs, size_t env, uint16_t keyMask) {
+    stepEnv(&p_envs->p_envs[env], keyMask, p_envs->instructionsPerFrame);
+}
+
+void cchip8_setInstructionsPerFrame(Cchip8Envs* p_envs,
+                                    uint32_t instructionsPerFrame) {
+    p_envs->instructionsPerFrame = instructionsPerFrame;
+}
+
+uint32_t cchip8_frameBudget(uint64_t emulationFreq, uint64_t frame) {
+    return (frame + 1) * emulationFreq / 60 - frame * emulationFreq / 60;
+}
+
+
+/* LIFETIME */
+
+bool cchip8_loadRom(const char* p_path,
+                    uint8_t p_rom[CCHIP8_MAX_ROM_SIZE],
+                    size_t* p_romSize) {
+    FILE* p_file = fopen(p_path, "rb");
+    if (p_file == NULL) return false;
+    *p_romSize = fread(p_rom, 1, CCHIP8_MAX_ROM_SIZE, p_file);
+    fclose(p_file);
+    return true;
+}
+
+Cchip8Envs* cchip8_create(size_t count,
+                          const uint8_t* p_rom,
+                          size_t romSize,
+                          uint32_t instructionsPerFrame,
+                          uint64_t* p_framebuffers,
+                          size_t threadCount) {
+    if (count == 0 || romSize > CCHIP8_MAX_ROM_SIZE) return NULL;
+
+    Cchip8Envs* p_envs = calloc(1, sizeof(*p_envs));
+    if (p_envs == NULL) return NULL;
+
+    pthread_mutex_init(&p_envs->mutex, NULL);
+    pthread_cond_init(&p_envs->startCond, NULL);
+    pthread_cond_init(&p_envs->doneCond, NULL);
+
+    p_envs->count = count;
+    p_envs->instructionsPerFrame = instructionsPerFrame;
+    if (romSize > 0) memcpy(p_envs->rom, p_rom, romSize);
+    p_envs->romSize = romSize;
+
+    p_envs->p_envs = calloc(count, sizeof(*p_envs->p_envs));
+    p_envs->ownsFramebuffers = p_framebuffers == NULL;
+    p_envs->p_framebuffers =
+        p_envs->ownsFramebuffers ? calloc(count * 32, sizeof(uint64_t))
+                                 : p_framebuffers;
+    if (p_envs->p_envs == NULL || p_envs->p_framebuffers == NULL) {
+        cchip8_destroy(p_envs);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        p_envs->p_envs[i].p_display = &p_envs->p_framebuffers[i * 32];
+        cchip8_reset(p_envs, i);
+    }
+
+    // The calling thread steps alongside the workers
+    p_envs->chunkSize = count / ((threadCount + 1) * CHUNKS_PER_THREAD);
+    if (p_envs->chunkSize == 0) p_envs->chunkSize = 1;
+
+    if (threadCount > 0) {
+        p_envs->p_threads = calloc(threadCount, sizeof(*p_envs->p_threads));
+        if (p_envs->p_threads == NULL) {
+            cchip8_destroy(p_envs);
+            return NULL;
+        }
+        for (; p_envs->threadCount < threadCount; p_envs->threadCount++)
+            if (pthread_create(&p_envs->p_threads[p_envs->threadCount],
+                               NULL,
+                               &worker,
+                               p_envs) != 0) {
+                cchip8_destroy(p_envs);
+                return NULL;
+            }
+    }
+
+    return p_envs;
+}
+
+void cchip8_destroy(Cchip8Envs* p_envs) {
+    if (p_envs == NULL) return;
+
+    if (p_envs->threadCount > 0) {
+        pthread_mutex_lock(&p_envs->mutex);
+        p_envs->stopping = true;
+        pthread_cond_broadcast(&p_envs->startCond);
+        pthread_mutex_unlock(&p_envs->mutex);
+
+        for (size_t i = 0; i < p_envs->threadCount; i++)
+            pthread_join(p_envs->p_threads[i], NULL);
+    }
+    pthread_mutex_destroy(&p_envs->mutex);
+    pthread_cond_destroy(&p_envs->startCond);
+    pthread_cond_destroy(&p_envs->doneCond);
+
+    free(p_envs->p_threads);
+    if (p_envs->ownsFramebuffers) free(p_envs->p_framebuffers);
+    free(p_envs->p_envs);
+    free(p_envs);
+}
+
+size_t cchip8_count(const Cchip8Envs* p_envs) { return p_envs->count; }
+
+void cchip8_reset(Cchip8Envs* p_envs, size_t env) {
+    Env* p_env = &p_envs->p_envs[env];
+
+    p_env->machineState = (MachineState){};
+    core_init(&p_env->machineState,
+              NULL,
+              NULL,
+              &heldKeys,
+              &getPixel,
+              &togglePixel,
+              &clearDisplay,
+              &sigIllHandler);
+    memcpy(&p_env->machineState.ram[ROM_ADDR], p_envs->rom, p_envs->romSize);
+
+    memset(p_env->p_display, 0, 32 * sizeof(uint64_t));
+    p_env->heldKeys = 0;
+    p_env->fault = CORE_FAULT_NONE;
+}
+
+void cchip8_seed(Cchip8Envs* p_envs, size_t env, uint32_t seed) {
+    p_envs->p_envs[env].machineState.rngState = seed;
+}
+
+
+/* OBSERVATION */
+
+Cchip8Fault cchip8_fault(const Cchip8Envs* p_envs,
+                         size_t env,
+                         uint16_t* p_faultAddr) {
+    const Env* p_env = &p_envs->p_envs[env];
+
+    if (p_faultAddr != NULL) *p_faultAddr = p_env->faultAddr;
+    return (Cchip8Fault)p_env->fault;
+}
+
+const uint64_t* cchip8_framebuffers(const Cchip8Envs* p_envs) {
+    return p_envs->p_framebuffers;
+}
+
+const uint8_t* cchip8_ram(const Cchip8Envs* p_envs, size_t env) {
+    return p_envs->p_envs[env].machineState.ram;
+}
+
+static inline uint64_t mixHash(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+    return hash ^ hash >> 32;
+}
+
+uint64_t cchip8_hash(const Cchip8Envs* p_envs, size_t env) {
+    const Env* p_env = &p_envs->p_envs[env];
+    const MachineState* p_machineState = &p_env->machineState;
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (size_t i = 0; i + 8 <= CORE_RAM_SIZE; i += 8) {
+        uint64_t word;
+        memcpy(&word, &p_machineState->ram[i], sizeof(word));
+        hash = mixHash(hash, word);
+    }
+    for (size_t i = CORE_RAM_SIZE / 8 * 8; i < CORE_RAM_SIZE; i++)
+        hash = mixHash(hash, p_machineState->ram[i]);
+
+    for (int i = 0; i < 16; i += 8) {
+        uint64_t word;
+        memcpy(&word, &p_machineState->varRegs[i], sizeof(word));
+        hash = mixHash(hash, word);
+    }
+    for (int i = 0; i < p_machineState->stackIdx && i < 16; i++)
+        hash = mixHash(hash, p_machineState->stack[i]);
+    hash = mixHash(hash,
+                   (uint64_t)p_machineState->programCounter |
+                       (uint64_t)p_machineState->indexReg << 16 |
+                       (uint64_t)p_machineState->stackIdx << 32 |
+                       (uint64_t)p_machineState->delayTimer << 40 |
+                       (uint64_t)p_machineState->soundTimer << 48);
+    hash = mixHash(hash,
+                   (uint64_t)p_machineState->previousHeldKeys |
+                       (uint64_t)p_machineState->rngState << 16);
+
+    for (int y = 0; y < 32; y++) hash = mixHash(hash, p_env->p_display[y]);
+
+    return hash;
+}
+
+size_t cchip8_stateSize() { return sizeof(State); }
+
+void cchip8_saveState(const Cchip8Envs* p_envs, size_t env, void* p_state) {
+    const Env* p_env = &p_envs->p_envs[env];
+    State* p_dest = p_state;
+
+    p_dest->machineState = p_env->machineState;
+    memcpy(p_dest->display, p_env->p_display, sizeof(p_dest->display));
+}
+
+void cchip8_loadState(Cchip8Envs* p_envs, size_t env, const void* p_state) {
+    Env* p_env = &p_envs->p_envs[env];
+    const State* p_src = p_state;
+
+    p_env->machineState = p_src->machineState;
+    memcpy(p_env->p_display, p_src->display, sizeof(p_src->display));
+    p_env->fault = CORE_FAULT_NONE;
+}
+
+
+/* SERIALIZATION */
+
+// RAM, PC, I, V0-VF, the stack and its index, the timers, the keys held at the
+// last FX0A, the random number generator state, the latched fault and its
+// address, and the display
+#define SERIALIZED_STATE_SIZE \
+    (CORE_RAM_SIZE + 2 + 2 + 16 + 16 * 2 + 1 + 1 + 1 + 2 + 4 + 1 + 2 + 32 * 8)
+
+size_t cchip8_serializedStateSize() { return SERIALIZED_STATE_SIZE; }
+
+void cchip8_serializeState(const Cchip8Envs* p_envs,
+                           size_t env,
+                           uint8_t* p_buf) {
+    const Env* p_env = &p_envs->p_envs[env];
+    const MachineState* p_machineState = &p_env->machineState;
+
+    memcpy(p_buf, p_machineState->ram, CORE_RAM_SIZE);
+    p_buf += CORE_RAM_SIZE;
+    p_buf = bytes_put(p_buf, p_machineState->programCounter, 2);
+    p_buf = bytes_put(p_buf, p_machineState->indexReg, 2);
+    memcpy(p_buf, p_machineState->varRegs, 16);
+    p_buf += 16;
+    for (int i = 0; i < 16; i++)
+        p_buf = bytes_put(p_buf, p_machineState->stack[i], 2);
+    p_buf = bytes_put(p_buf, p_machineState->stackIdx, 1);
+    p_buf = bytes_put(p_buf, p_machineState->delayTimer, 1);
+    p_buf = bytes_put(p_buf, p_machineState->soundTimer, 1);
+    p_buf = bytes_put(p_buf, p_machineState->previousHeldKeys, 2);
+    p_buf = bytes_put(p_buf, p_machineState->rngState, 4);
+    p_buf = bytes_put(p_buf, p_env->fault, 1);
+    p_buf = bytes_put(p_buf, p_env->faultAddr, 2);
+    for (int y = 0; y < 32; y++)
+        p_buf = bytes_put(p_buf, p_env->p_display[y], 8);
+}
+
+bool cchip8_deserializeState(Cchip8Envs* p_envs,
+                             size_t env,
+                             const uint8_t* p_buf) {
+    Env* p_env = &p_envs->p_envs[env];
+    // Parsed into a copy, so that an invalid state leaves the environment as is
+    MachineState machineState = p_env->machineState;
+    uint64_t display[32];
+    uint64_t val;
+
+    memcpy(machineState.ram, p_buf, CORE_RAM_SIZE);
+    p_buf += CORE_RAM_SIZE;
+    p_buf = bytes_get(p_buf, &val, 2);
+    machineState.programCounter = val;
+    p_buf = bytes_get(p_buf, &val, 2);
+    machineState.indexReg = val;
+    memcpy(machineState.varRegs, p_buf, 16);
+    p_buf += 16;
+    for (int i = 0; i < 16; i++) {
+        p_buf = bytes_get(p_buf, &val, 2);
+        machineState.stack[i] = val;
+    }
+    p_buf = bytes_get(p_buf, &val, 1);
+    machineState.stackIdx = val;
+    p_buf = bytes_get(p_buf, &val, 1);
+    machineState.delayTimer = val;
+    p_buf = bytes_get(p_buf, &val, 1);
+    machineState.soundTimer = val;
+    p_buf = bytes_get(p_buf, &val, 2);
+    machineState.previousHeldKeys = val;
+    p_buf = bytes_get(p_buf, &val, 4);
+    machineState.rngState = val;
+    uint64_t fault, faultAddr;
+    p_buf = bytes_get(p_buf, &fault, 1);
+    p_buf = bytes_get(p_buf, &faultAddr, 2);
+    for (int y = 0; y < 32; y++) p_buf = bytes_get(p_buf, &display[y], 8);
+
+    // The stack index is trusted by `pop`, and xorshift never leaves 0
+    if (machineState.stackIdx > 16 || machineState.rngState == 0 ||
+        fault > CORE_FAULT_STACK_UNDERFLOW)
+        return false;
+
+    // A faulted environment stays stopped, as it was when serialized
+    machineState.fault = fault;
+    p_env->machineState = machineState;
+    memcpy(p_env->p_display, display, sizeof(display));
+    p_env->fault = fault;
+    p_env->faultAddr = faultAddr;
+    return true;
+}
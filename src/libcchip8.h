@@ -0,0 +1,200 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CCHIP8_API __attribute__((visibility("default")))
+#else
+#define CCHIP8_API
+#endif
+
+/**
+ * A batch of independent emulated machines ("environments") that are stepped
+ * together, one 60 Hz frame at a time.
+ *
+ * Each environment carries its own display and held keys, so unlike the bare
+ * core no host side globals are needed.
+ */
+typedef struct Cchip8Envs Cchip8Envs;
+
+/// Why an environment stopped executing, mirrors `CoreFault`
+typedef enum Cchip8Fault {
+    CCHIP8_FAULT_NONE,
+    CCHIP8_FAULT_ILLEGAL_INSTRUCTION,
+    CCHIP8_FAULT_STACK_OVERFLOW,
+    CCHIP8_FAULT_STACK_UNDERFLOW,
+} Cchip8Fault;
+
+/// The largest ROM that fits in RAM, which it is loaded into at `0x0200`
+#define CCHIP8_MAX_ROM_SIZE (4096 - 0x0200)
+
+/**
+ * Reads a ROM file for `cchip8_create`, up to `CCHIP8_MAX_ROM_SIZE` bytes.
+ *
+ * @param p_path     The path of the ROM file
+ * @param p_rom      Where to read the ROM into
+ * @param p_romSize  Set to the size of the ROM read
+ *
+ * @returns Whether the file could be opened
+ */
+CCHIP8_API bool cchip8_loadRom(const char* p_path,
+                               uint8_t p_rom[CCHIP8_MAX_ROM_SIZE],
+                               size_t* p_romSize);
+
+/**
+ * Creates `count` environments all running `p_rom`.
+ *
+ * @param count                 The number of environments to create
+ * @param p_rom                 The program ROM, loaded at `0x0200`
+ * @param romSize               The size of `p_rom` in bytes, at most
+ *                              `CCHIP8_MAX_ROM_SIZE`
+ * @param instructionsPerFrame  The number of instructions executed per frame
+ * @param p_framebuffers        Storage for `count * 32` display rows, which
+ *                              the environments draw into directly. Row `y` of
+ *                              environment `i` is at index `i * 32 + y`, and
+ *                              bit `63 - x` of a row is the pixel at `x`.
+ *                              Allocated internally if NULL.
+ * @param threadCount           The number of worker threads used by
+ *                              `cchip8_step`, 0 to step on the calling thread
+ *
+ * @returns The environments, or NULL if they could not be created
+ */
+CCHIP8_API Cchip8Envs* cchip8_create(size_t count,
+                                     const uint8_t* p_rom,
+                                     size_t romSize,
+                                     uint32_t instructionsPerFrame,
+                                     uint64_t* p_framebuffers,
+                                     size_t threadCount);
+
+/// Stops the worker threads and frees `p_envs`
+CCHIP8_API void cchip8_destroy(Cchip8Envs* p_envs);
+
+/// @returns The number of environments in `p_envs`
+CCHIP8_API size_t cchip8_count(const Cchip8Envs* p_envs);
+
+/// Restarts environment `env` from the freshly loaded ROM with a clear display
+CCHIP8_API void cchip8_reset(Cchip8Envs* p_envs, size_t env);
+
+/// Seeds the random number generator used by `CXNN`, `seed` must not be 0
+CCHIP8_API void cchip8_seed(Cchip8Envs* p_envs, size_t env, uint32_t seed);
+
+/**
+ * Records the branch edges taken by environment `env` into `p_bitmap`.
+ *
+ * Every executed instruction increments (saturating at 255) the byte for the
+ * edge from its address to the address executed next.
+ *
+ * @param p_envs        The environments
+ * @param env           The environment to record
+ * @param p_bitmap      The coverage bitmap, NULL to stop recording
+ * @param bitmapSize    The size of `p_bitmap`, which must be a power of two
+ */
+CCHIP8_API void cchip8_setCoverage(Cchip8Envs* p_envs,
+                                   size_t env,
+                                   uint8_t* p_bitmap,
+                                   size_t bitmapSize);
+
+/**
+ * Emulates one frame of every environment, spread over the worker threads.
+ *
+ * @param p_envs        The environments to step
+ * @param p_keyMasks    The keys held by each environment during the frame, as
+ *                      bitflags
+ */
+CCHIP8_API void cchip8_step(Cchip8Envs* p_envs, const uint16_t* p_keyMasks);
+
+/// Emulates one frame of environment `env` on the calling thread
+CCHIP8_API void cchip8_stepOne(Cchip8Envs* p_envs,
+                               size_t env,
+                               uint16_t keyMask);
+
+/// Sets the number of instructions executed per frame by the following steps
+CCHIP8_API void cchip8_setInstructionsPerFrame(Cchip8Envs* p_envs,
+                                               uint32_t instructionsPerFrame);
+
+/**
+ * Gets the instructions to execute in a frame so that, on average,
+ * `emulationFreq` instructions are executed per second. What doesn't divide
+ * evenly into 60 frames is spread over them.
+ *
+ * @param emulationFreq The instructions per second
+ * @param frame         The number of frames emulated before this one
+ */
+CCHIP8_API uint32_t cchip8_frameBudget(uint64_t emulationFreq, uint64_t frame);
+
+/**
+ * Gets the first fault of environment `env` since it was last reset or loaded.
+ *
+ * A faulted environment stops executing instructions until it is reset or
+ * loaded, its timers keep ticking.
+ *
+ * @param p_envs        The environments
+ * @param env           The environment to query
+ * @param p_faultAddr   Set to the address of the faulting instruction, if not
+ *                      NULL
+ *
+ * @returns The fault, `CCHIP8_FAULT_NONE` if there wasn't one
+ */
+CCHIP8_API Cchip8Fault cchip8_fault(const Cchip8Envs* p_envs,
+                                    size_t env,
+                                    uint16_t* p_faultAddr);
+
+/// @returns The display rows of every environment, laid out as described in
+/// `cchip8_create`
+CCHIP8_API const uint64_t* cchip8_framebuffers(const Cchip8Envs* p_envs);
+
+/// @returns The RAM of environment `env`, `CORE_RAM_SIZE` (4096) bytes long
+CCHIP8_API const uint8_t* cchip8_ram(const Cchip8Envs* p_envs, size_t env);
+
+/**
+ * Hashes everything that affects how environment `env` runs from here on: its
+ * RAM, registers, stack, timers, random number generator state and display.
+ *
+ * @returns A 64 bit hash, equal for environments in the same state
+ */
+CCHIP8_API uint64_t cchip8_hash(const Cchip8Envs* p_envs, size_t env);
+
+/// @returns The size in bytes of the buffers used by `cchip8_saveState` and
+/// `cchip8_loadState`, which must be aligned like those from `malloc`
+CCHIP8_API size_t cchip8_stateSize();
+
+/**
+ * Saves the machine state and display of environment `env` to `p_state`.
+ *
+ * The state is only meaningful to the process that saved it.
+ */
+CCHIP8_API void cchip8_saveState(const Cchip8Envs* p_envs,
+                                 size_t env,
+                                 void* p_state);
+
+/// Restores environment `env` from a state saved by `cchip8_saveState`
+CCHIP8_API void cchip8_loadState(Cchip8Envs* p_envs,
+                                 size_t env,
+                                 const void* p_state);
+
+/// @returns The size in bytes of the buffers used by `cchip8_serializeState`
+/// and `cchip8_deserializeState`
+CCHIP8_API size_t cchip8_serializedStateSize();
+
+/**
+ * Serializes the machine state, latched fault and display of environment `env`
+ * to `p_buf`.
+ *
+ * Unlike `cchip8_saveState`, the result is little endian with no padding, so
+ * it can be stored and loaded by other builds and hosts.
+ */
+CCHIP8_API void cchip8_serializeState(const Cchip8Envs* p_envs,
+                                      size_t env,
+                                      uint8_t* p_buf);
+
+/**
+ * Restores environment `env` from a state written by `cchip8_serializeState`.
+ *
+ * @returns Whether the state was valid, the environment is left unchanged if
+ *          not
+ */
+CCHIP8_API bool cchip8_deserializeState(Cchip8Envs* p_envs,
+                                        size_t env,
+                                        const uint8_t* p_buf);
@@ -6,6 +6,7 @@
 #include <SDL3/SDL_main.h>
 
 #include "core.h"
+#include "debugger.h"
 
 #define VERSION "0.1.0"
 #define PROG_NAME "cchip8"
@@ -39,7 +40,13 @@ uint64_t g_keyRepeat[16] = {};
 // Whether the key has been released but is still being buffered
 bool g_keyReleased[16] = {};
 
+// Set while emulating speculative frames, which must not consume key releases
+bool g_runningAhead = false;
+uint16_t g_runAheadKeys = 0;
+
 uint16_t heldKeys() {
+    if (g_runningAhead) return g_runAheadKeys;
+
     uint16_t heldKeys = 0;
 
     for (int i = 0; i < 16; i++) {
@@ -60,22 +67,295 @@ static SDL_Renderer* gp_renderer = NULL;
 #define OFF_COLOUR 0x8f9185
 #define ON_COLOUR 0x111d2b
 bool g_windowNeedsRedraw = false;
-uint64_t g_dispTick = 0;
 
 uint64_t g_emulationFreq = 500;
-uint64_t g_emulTick = 0;
+// Sixtieths of an instruction left over from previous frames' budgets
+uint64_t g_instructionCarry = 0;
+// Instructions of a frame the debugger stopped in the middle of, its timers
+// and key repeats are ticked once they have been executed
+uint64_t g_interruptedInstructions = 0;
 bool g_runEmul = true;
 
+uint64_t g_debuggerTick = 0;
+
 
-bool g_displayBuffer[64][32];
-bool getPixel(uint8_t x, uint8_t y) { return g_displayBuffer[x % 64][y % 32]; }
+// One row per element, bit `63 - x` is the pixel at `x`
+uint64_t g_displayBuffer[32];
+bool getPixel(uint8_t x, uint8_t y) {
+    return g_displayBuffer[y % 32] >> (63 - x % 64) & 0b1;
+}
 void togglePixel(uint8_t x, uint8_t y) {
-    g_displayBuffer[x % 64][y % 32] = !g_displayBuffer[x % 64][y % 32];
+    g_displayBuffer[y % 32] ^= 1ull << (63 - x % 64);
 }
 void clearDisplay() { memset(g_displayBuffer, 0, sizeof(g_displayBuffer)); }
 
 
-void sigIllHandler() {}
+/**
+ * @returns How many instructions to execute in the next 60 Hz frame, which
+ *          keeps the emulation at `g_emulationFreq` on average
+ */
+uint64_t frameBudget() {
+    uint64_t instructions = (g_emulationFreq + g_instructionCarry) / 60;
+    g_instructionCarry = (g_emulationFreq + g_instructionCarry) % 60;
+    return instructions;
+}
+
+
+/* RUN-AHEAD */
+
+#define MAX_RUN_AHEAD_FRAMES 8
+
+// How many 60 Hz frames to emulate ahead of the machine, 0 to disable
+uint64_t g_runAheadFrames = 0;
+// The speculative display presented instead of `g_displayBuffer`
+uint64_t g_runAheadBuffer[32];
+
+typedef struct Snapshot {
+    MachineState machineState;
+    uint64_t displayBuffer[32];
+} Snapshot;
+
+/**
+ * Emulates `g_runAheadFrames` frames ahead of `p_machineState` with the keys
+ * currently held, stores the resulting display in `g_runAheadBuffer`, and rolls
+ * the machine back.
+ *
+ * @returns Whether `g_runAheadBuffer` changed
+ */
+bool runAhead(MachineState* p_machineState) {
+    static Snapshot snapshot;
+    snapshot.machineState = *p_machineState;
+    memcpy(snapshot.displayBuffer, g_displayBuffer, sizeof(g_displayBuffer));
+
+    g_runAheadKeys = 0;
+    for (int i = 0; i < 16; i++)
+        if (g_keyRepeat[i] > 0) g_runAheadKeys |= 0b1 << i;
+    g_runningAhead = true;
+
+    // Speculate with the same budgets the coming frames will get
+    uint64_t instructionCarry = g_instructionCarry;
+    for (uint64_t frame = 0; frame < g_runAheadFrames; frame++) {
+        uint64_t instructions = frameBudget();
+        for (uint64_t i = 0; i < instructions; i++) core_tick(p_machineState);
+        core_timerTick(p_machineState);
+    }
+    g_instructionCarry = instructionCarry;
+
+    g_runningAhead = false;
+    bool changed = memcmp(g_runAheadBuffer,
+                          g_displayBuffer,
+                          sizeof(g_displayBuffer)) != 0;
+    memcpy(g_runAheadBuffer, g_displayBuffer, sizeof(g_displayBuffer));
+
+    *p_machineState = snapshot.machineState;
+    memcpy(g_displayBuffer, snapshot.displayBuffer, sizeof(g_displayBuffer));
+
+    return changed;
+}
+
+
+/* GOVERNOR */
+
+#define NS_PER_FRAME (1000000000 / 60)
+// Most frames emulated in one iteration to catch up, beyond which frames are
+// dropped and the emulation slows down
+#define MAX_CATCH_UP_FRAMES 4
+// Most frames emulated in a row without rendering, to keep up with the
+// emulation
+#define MAX_SKIPPED_RENDERS 3
+// Iterations averaged over by the telemetry
+#define TELEMETRY_WINDOW 64
+
+// When the next 60 Hz frame is due
+uint64_t g_frameTick = 0;
+uint64_t g_skippedRenders = 0;
+
+/// Host time spent in one iteration of the main loop
+typedef struct IterationTimes {
+    uint64_t frames;
+    uint64_t coreNs;
+    bool rendered;
+    uint64_t renderNs;
+    uint64_t presentNs;
+} IterationTimes;
+
+IterationTimes g_iterationTimes[TELEMETRY_WINDOW] = {};
+size_t g_iterationTimesIdx = 0;
+
+// Counts since the telemetry was last logged
+uint64_t g_emulatedFrames = 0;
+uint64_t g_droppedFrames = 0;
+uint64_t g_renderedFrames = 0;
+uint64_t g_telemetryTick = 0;
+
+bool g_showTelemetry = false;
+// The panel's text, updated whenever the telemetry is logged
+char g_telemetryText[256] = "";
+
+/// Averages the host time spent per frame, render and present
+void averageTimes(uint64_t* p_coreNs,
+                  uint64_t* p_renderNs,
+                  uint64_t* p_presentNs) {
+    uint64_t frames = 0, renders = 0;
+    uint64_t coreNs = 0, renderNs = 0, presentNs = 0;
+    for (int i = 0; i < TELEMETRY_WINDOW; i++) {
+        const IterationTimes* p_times = &g_iterationTimes[i];
+        frames += p_times->frames;
+        coreNs += p_times->coreNs;
+        renders += p_times->rendered;
+        renderNs += p_times->renderNs;
+        presentNs += p_times->presentNs;
+    }
+
+    *p_coreNs = frames > 0 ? coreNs / frames : 0;
+    *p_renderNs = renders > 0 ? renderNs / renders : 0;
+    *p_presentNs = renders > 0 ? presentNs / renders : 0;
+}
+
+/**
+ * @returns How many frames can be emulated in one iteration while still
+ *          finishing within a frame
+ */
+uint64_t catchUpLimit() {
+    uint64_t coreNs, renderNs, presentNs;
+    averageTimes(&coreNs, &renderNs, &presentNs);
+
+    if (coreNs == 0) return MAX_CATCH_UP_FRAMES;
+    uint64_t limit = NS_PER_FRAME / coreNs;
+    if (limit < 1) return 1;
+    return limit < MAX_CATCH_UP_FRAMES ? limit : MAX_CATCH_UP_FRAMES;
+}
+
+/**
+ * Emulates one 60 Hz frame, with the instruction budget from `frameBudget`.
+ * Finishes the frame the debugger stopped in instead, if there is one.
+ *
+ * @returns Whether the display was updated
+ */
+bool emulateFrame(MachineState* p_machineState) {
+    uint64_t instructions = g_interruptedInstructions > 0
+                                ? g_interruptedInstructions
+                                : frameBudget();
+
+#if DEBUG
+    printf("\x1b[2J\x1b[H");
+    printf("Emulation frequency  : %lu Hz\n", g_emulationFreq);
+    printf("Instruction budget   : %lu\n", instructions);
+    printf("Run-ahead frames     : %lu\n", g_runAheadFrames);
+
+    uint16_t held = 0;
+    for (int i = 0; i < 16; i++)
+        if (g_keyRepeat[i]) held |= 0b1 << i;
+    printf("Held keys: %016B\n", held);
+    printf("           FEDCBA9876543210\n\n");
+#endif
+
+    bool updatedDisp = false;
+    for (uint64_t i = 0; i < instructions; i++)
+        updatedDisp |= debugger_tick(p_machineState);
+    // The debugger stopped the machine mid frame, `debugger_tick` has been
+    // doing nothing since, so finish the frame once it resumes
+    g_interruptedInstructions = debugger_takeSkippedTicks();
+    if (g_interruptedInstructions > 0) return updatedDisp;
+
+    // Tick the delay and sound timers
+    // Increment the key repeat
+    core_timerTick(p_machineState);
+    for (int i = 0; i < 16; i++) {
+        // If the key has been released and exceeded the buffer duration
+        if (g_keyRepeat[i] > KEY_BUFFER_DUR && g_keyReleased[i]) {
+            g_keyRepeat[i] = 0;
+            g_keyReleased[i] = false;
+        }
+        if (g_keyRepeat[i] > 0) g_keyRepeat[i]++;
+    }
+
+    return updatedDisp;
+}
+
+/// Logs the telemetry once a second, and whenever frames were dropped
+void logTelemetry(uint64_t currentTicks) {
+    if (currentTicks - g_telemetryTick < 1000000000) return;
+    double seconds = (currentTicks - g_telemetryTick) / 1e9;
+    g_telemetryTick = currentTicks;
+
+    uint64_t coreNs, renderNs, presentNs;
+    averageTimes(&coreNs, &renderNs, &presentNs);
+    snprintf(g_telemetryText,
+             sizeof(g_telemetryText),
+             "emulated %5.1f fps\n"
+             "rendered %5.1f fps\n"
+             "dropped  %5lu\n"
+             "core     %5.2f ms/frame\n"
+             "render   %5.2f ms\n"
+             "present  %5.2f ms\n"
+             "freq     %5lu Hz",
+             g_emulatedFrames / seconds,
+             g_renderedFrames / seconds,
+             g_droppedFrames,
+             coreNs / 1e6,
+             renderNs / 1e6,
+             presentNs / 1e6,
+             g_emulationFreq);
+
+    if (g_showTelemetry || g_droppedFrames > 0) {
+        // One line for the log
+        char line[sizeof(g_telemetryText) * 2];
+        size_t len = 0;
+        for (size_t i = 0; g_telemetryText[i] != '\0'; i++) {
+            if (g_telemetryText[i] == '\n') line[len++] = ',';
+            line[len++] =
+                g_telemetryText[i] == '\n' ? ' ' : g_telemetryText[i];
+        }
+        line[len] = '\0';
+        SDL_Log("%s", line);
+    }
+    if (g_showTelemetry) g_windowNeedsRedraw = true;
+
+    g_emulatedFrames = 0;
+    g_renderedFrames = 0;
+    g_droppedFrames = 0;
+}
+
+/// Draws the telemetry panel over the display, in window pixels
+void renderTelemetry() {
+    SDL_SetRenderLogicalPresentation(
+        gp_renderer, 0, 0, SDL_LOGICAL_PRESENTATION_DISABLED);
+    SDL_SetRenderScale(gp_renderer, 2, 2);
+
+    SDL_SetRenderDrawColor(gp_renderer,
+                           OFF_COLOUR >> 16 & 0xFF,
+                           OFF_COLOUR >> 8 & 0xFF,
+                           OFF_COLOUR & 0xFF,
+                           SDL_ALPHA_OPAQUE);
+    SDL_RenderFillRect(gp_renderer, &(SDL_FRect){0, 0, 8 * 25, 8 * 8});
+
+    SDL_SetRenderDrawColor(gp_renderer,
+                           ON_COLOUR >> 16 & 0xFF,
+                           ON_COLOUR >> 8 & 0xFF,
+                           ON_COLOUR & 0xFF,
+                           SDL_ALPHA_OPAQUE);
+    const char* p_line = g_telemetryText;
+    for (int y = 4; *p_line != '\0'; y += 8) {
+        char line[32] = {};
+        size_t len = strcspn(p_line, "\n");
+        memcpy(line, p_line, len < sizeof(line) ? len : sizeof(line) - 1);
+        SDL_RenderDebugText(gp_renderer, 4, y, line);
+        p_line += len;
+        if (*p_line == '\n') p_line++;
+    }
+
+    SDL_SetRenderScale(gp_renderer, 1, 1);
+    SDL_SetRenderLogicalPresentation(
+        gp_renderer, 64, 32, SDL_LOGICAL_PRESENTATION_STRETCH);
+}
+
+
+// Speculative frames run on `core_tick`, so breakpoints are never hit in them,
+// but they may fault ahead of the machine, which must not stop it
+void sigIllHandler() {
+    if (!g_runningAhead) debugger_trap();
+}
 
 
 SDL_AppResult SDL_AppInit(void** pp_appstate, int argc, char* p_argv[]) {
@@ -129,6 +409,9 @@ SDL_AppResult SDL_AppInit(void** pp_appstate, int argc, char* p_argv[]) {
               &togglePixel,
               &clearDisplay,
               &sigIllHandler);
+    debugger_attach(&machineState);
+    g_frameTick = SDL_GetTicksNS();
+    g_telemetryTick = g_frameTick;
 
     // Load program ROM
     FILE* romFile = fopen(p_argv[1], "rb");
@@ -173,12 +456,29 @@ SDL_AppResult SDL_AppEvent(void*, SDL_Event* event) {
         g_runEmul = !g_runEmul;
 
     if (event->type == SDL_EVENT_KEY_DOWN &&
-        event->key.scancode == SDL_SCANCODE_MINUS)
+        event->key.scancode == SDL_SCANCODE_MINUS && g_emulationFreq > 100)
         g_emulationFreq -= 100;
     if (event->type == SDL_EVENT_KEY_DOWN &&
         event->key.scancode == SDL_SCANCODE_EQUALS)
         g_emulationFreq += 100;
 
+    if (event->type == SDL_EVENT_KEY_DOWN &&
+        event->key.scancode == SDL_SCANCODE_LEFTBRACKET &&
+        g_runAheadFrames > 0) {
+        g_runAheadFrames--;
+        g_windowNeedsRedraw = true;
+    }
+    if (event->type == SDL_EVENT_KEY_DOWN &&
+        event->key.scancode == SDL_SCANCODE_RIGHTBRACKET &&
+        g_runAheadFrames < MAX_RUN_AHEAD_FRAMES)
+        g_runAheadFrames++;
+
+    if (event->type == SDL_EVENT_KEY_DOWN &&
+        event->key.scancode == SDL_SCANCODE_TAB) {
+        g_showTelemetry = !g_showTelemetry;
+        g_windowNeedsRedraw = true;
+    }
+
 
     if (event->type == SDL_EVENT_KEY_DOWN)
         for (int i = 0; i < 16; i++)
@@ -201,53 +501,67 @@ SDL_AppResult SDL_AppIterate(void* p_appstate) {
 
     bool emulUpdatedDisp = false;
     uint64_t currentTicks = SDL_GetTicksNS();
+    IterationTimes times = {};
 
     /* CORE TICKING */
 
-    // Tick the core if needed
-    if (g_runEmul &&
-        (currentTicks - g_emulTick) > (1000000000 / g_emulationFreq)) {
-#if DEBUG
-        printf("\x1b[2J\x1b[H");
-        printf("Emulation frequency  : %lu Hz\n", g_emulationFreq);
-        printf("Emulation time period: %g ms\n",
-               ((double)currentTicks - g_emulTick) / 1000000);
-
-        uint16_t held = 0;
-        for (int i = 0; i < 16; i++)
-            if (g_keyRepeat[i]) held |= 0b1 << i;
-        printf("Held keys: %016B\n", held);
-        printf("           FEDCBA9876543210\n\n");
-#endif
+    // Emulate the frames that are due, catching up on ones the host fell
+    // behind on, but don't catch up on time spent paused
+    if (!g_runEmul || debugger_isStopped()) {
+        g_frameTick = currentTicks;
+    } else if (currentTicks >= g_frameTick) {
+        uint64_t dueFrames = (currentTicks - g_frameTick) / NS_PER_FRAME + 1;
+        uint64_t limit = catchUpLimit();
+        if (dueFrames > limit) {
+            g_droppedFrames += dueFrames - limit;
+            dueFrames = limit;
+            g_frameTick = currentTicks + NS_PER_FRAME;
+        } else {
+            g_frameTick += dueFrames * NS_PER_FRAME;
+        }
 
-        g_emulTick = currentTicks;
+        for (; times.frames < dueFrames && !debugger_isStopped();
+             times.frames++)
+            emulUpdatedDisp |= emulateFrame(p_machineState);
+        g_emulatedFrames += times.frames;
 
-        emulUpdatedDisp = core_tick(p_machineState);
-    };
+        // Only the last frame's speculation is ever shown
+        if (g_runAheadFrames > 0 && !debugger_isStopped() &&
+            runAhead(p_machineState))
+            g_windowNeedsRedraw = true;
 
-    // Tick the delay and sound timers at 60 Hz
-    // Increment the key repeat
-    if (g_runEmul && (currentTicks - g_dispTick) > (1000000000 / 60)) {
-        g_dispTick = currentTicks;
-        core_timerTick(p_machineState);
+        times.coreNs = SDL_GetTicksNS() - currentTicks;
+    }
 
-        for (int i = 0; i < 16; i++) {
-            // If the key has been released and exceeded the buffer duration
-            if (g_keyRepeat[i] > KEY_BUFFER_DUR && g_keyReleased[i]) {
-                g_keyRepeat[i] = 0;
-                g_keyReleased[i] = false;
-            }
-            if (g_keyRepeat[i] > 0) g_keyRepeat[i]++;
-        }
+    // Check the debugger console at 60 Hz, even while the machine is stopped
+    if ((currentTicks - g_debuggerTick) > (1000000000 / 60)) {
+        g_debuggerTick = currentTicks;
+        debugger_poll();
     }
 
 
     /* DISPLAY */
 
     // Update the display when the display buffer is updated or window is
-    // resized
-    if (emulUpdatedDisp || g_windowNeedsRedraw) {
+    // resized. While running ahead, only the speculative display is shown.
+    if (emulUpdatedDisp && g_runAheadFrames == 0) g_windowNeedsRedraw = true;
+
+    logTelemetry(currentTicks);
+
+    // Skip rendering when there isn't enough time left before the next frame
+    // is due, so that the render rate drops before the emulation rate does
+    uint64_t coreNs, renderNs, presentNs;
+    averageTimes(&coreNs, &renderNs, &presentNs);
+    uint64_t renderTicks = SDL_GetTicksNS();
+    bool renderDelaysFrame = g_runEmul && !debugger_isStopped() &&
+                             renderTicks + renderNs + presentNs > g_frameTick;
+    if (g_windowNeedsRedraw && renderDelaysFrame &&
+        g_skippedRenders < MAX_SKIPPED_RENDERS) {
+        // Counted in frames, as the iterations between frames are free
+        g_skippedRenders += times.frames;
+    } else if (g_windowNeedsRedraw) {
         g_windowNeedsRedraw = false;
+        g_skippedRenders = 0;
 
         // Clear the screen to the off colour
         SDL_SetRenderDrawColor(gp_renderer,
@@ -264,12 +578,28 @@ SDL_AppResult SDL_AppIterate(void* p_appstate) {
                                ON_COLOUR >> 8 & 0xFF,
                                ON_COLOUR >> 8 & 0xFF,
                                SDL_ALPHA_OPAQUE);
+        const uint64_t* p_displayBuffer =
+            g_runAheadFrames > 0 ? g_runAheadBuffer : g_displayBuffer;
         for (int y = 0; y < 32; y++)
             for (int x = 0; x < 64; x++)
-                if (g_displayBuffer[x][y]) SDL_RenderPoint(gp_renderer, x, y);
+                if (p_displayBuffer[y] >> (63 - x) & 0b1)
+                    SDL_RenderPoint(gp_renderer, x, y);
+
+        if (g_showTelemetry) renderTelemetry();
 
         // Present the screen
+        uint64_t presentTicks = SDL_GetTicksNS();
         SDL_RenderPresent(gp_renderer);
+
+        times.rendered = true;
+        times.renderNs = presentTicks - renderTicks;
+        times.presentNs = SDL_GetTicksNS() - presentTicks;
+        g_renderedFrames++;
+    }
+
+    if (times.frames > 0 || times.rendered) {
+        g_iterationTimes[g_iterationTimesIdx] = times;
+        g_iterationTimesIdx = (g_iterationTimesIdx + 1) % TELEMETRY_WINDOW;
     }
 
     return SDL_APP_CONTINUE;
@@ -0,0 +1,303 @@
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytes.h"
+
+#define MOVIE_MAGIC "CH8M"
+#define MOVIE_VERSION 3
+
+// Magic, version, flags, emulation frequency, seed, keyframe interval and
+// frame count
+#define HEADER_SIZE (4 + 2 + 2 + 4 + 4 + 4 + 4)
+// Held keys and display hash
+#define FRAME_SIZE (2 + 8)
+
+#define INITIAL_FRAME_CAPACITY 1024
+
+
+/* ENCODING */
+
+uint64_t movie_displayHash(const Cchip8Envs* p_envs, size_t env) {
+    const uint64_t* p_display = &cchip8_framebuffers(p_envs)[env * 32];
+
+    // FNV-1a over the rows in little endian, so hashes match across hosts
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int y = 0; y < 32; y++)
+        for (int i = 0; i < 8; i++) {
+            hash ^= (uint8_t)(p_display[y] >> (8 * i));
+            hash *= 0x100000001B3ull;
+        }
+    return hash;
+}
+
+
+/* RECORDING */
+
+bool movie_startRecording(Movie* p_movie,
+                          const Cchip8Envs* p_envs,
+                          size_t env,
+                          uint32_t emulationFreq,
+                          uint32_t seed,
+                          uint32_t keyframeInterval) {
+    *p_movie = (Movie){
+        .emulationFreq = emulationFreq,
+        .seed = seed,
+        .keyframeInterval = keyframeInterval,
+        .p_initialState = malloc(cchip8_serializedStateSize()),
+        .p_keys = malloc(INITIAL_FRAME_CAPACITY * sizeof(uint16_t)),
+        .p_displayHashes = malloc(INITIAL_FRAME_CAPACITY * sizeof(uint64_t)),
+        .frameCapacity = INITIAL_FRAME_CAPACITY,
+    };
+    if (p_movie->p_initialState == NULL || p_movie->p_keys == NULL ||
+        p_movie->p_displayHashes == NULL || keyframeInterval == 0) {
+        movie_free(p_movie);
+        return false;
+    }
+
+    cchip8_serializeState(p_envs, env, p_movie->p_initialState);
+    return true;
+}
+
+bool movie_recordFrame(Movie* p_movie,
+                       const Cchip8Envs* p_envs,
+                       size_t env,
+                       uint16_t keys) {
+    if (p_movie->frameCount == p_movie->frameCapacity) {
+        size_t capacity = p_movie->frameCapacity * 2;
+        uint16_t* p_keys =
+            realloc(p_movie->p_keys, capacity * sizeof(uint16_t));
+        if (p_keys == NULL) return false;
+        p_movie->p_keys = p_keys;
+        uint64_t* p_displayHashes =
+            realloc(p_movie->p_displayHashes, capacity * sizeof(uint64_t));
+        if (p_displayHashes == NULL) return false;
+        p_movie->p_displayHashes = p_displayHashes;
+        p_movie->frameCapacity = capacity;
+    }
+
+    p_movie->p_keys[p_movie->frameCount] = keys;
+    p_movie->p_displayHashes[p_movie->frameCount] =
+        movie_displayHash(p_envs, env);
+    p_movie->frameCount++;
+
+    if (p_movie->frameCount % p_movie->keyframeInterval == 0) {
+        size_t stateSize = cchip8_serializedStateSize();
+        uint8_t* p_keyframes =
+            realloc(p_movie->p_keyframes,
+                    (p_movie->keyframeCount + 1) * stateSize);
+        if (p_keyframes == NULL) return false;
+        p_movie->p_keyframes = p_keyframes;
+        cchip8_serializeState(
+            p_envs, env, &p_keyframes[p_movie->keyframeCount * stateSize]);
+        p_movie->keyframeCount++;
+    }
+
+    return true;
+}
+
+void movie_free(Movie* p_movie) {
+    free(p_movie->p_initialState);
+    free(p_movie->p_keys);
+    free(p_movie->p_displayHashes);
+    free(p_movie->p_keyframes);
+    *p_movie = (Movie){};
+}
+
+
+/* FILES */
+
+bool movie_save(const Movie* p_movie, const char* p_path) {
+    FILE* p_file = fopen(p_path, "wb");
+    if (p_file == NULL) return false;
+
+    uint8_t header[HEADER_SIZE];
+    uint8_t* p_buf = header;
+    memcpy(p_buf, MOVIE_MAGIC, 4);
+    p_buf = bytes_put(p_buf + 4, MOVIE_VERSION, 2);
+    // Flags, reserved for future versions
+    p_buf = bytes_put(p_buf, 0, 2);
+    p_buf = bytes_put(p_buf, p_movie->emulationFreq, 4);
+    p_buf = bytes_put(p_buf, p_movie->seed, 4);
+    p_buf = bytes_put(p_buf, p_movie->keyframeInterval, 4);
+    bytes_put(p_buf, p_movie->frameCount, 4);
+
+    size_t stateSize = cchip8_serializedStateSize();
+    bool ok = fwrite(header, 1, HEADER_SIZE, p_file) == HEADER_SIZE &&
+              fwrite(p_movie->p_initialState, 1, stateSize, p_file) ==
+                  stateSize;
+
+    for (size_t i = 0; ok && i < p_movie->frameCount; i++) {
+        uint8_t frame[FRAME_SIZE];
+        bytes_put(bytes_put(frame, p_movie->p_keys[i], 2),
+                  p_movie->p_displayHashes[i],
+                  8);
+        ok = fwrite(frame, 1, FRAME_SIZE, p_file) == FRAME_SIZE;
+    }
+
+    size_t keyframesSize = p_movie->keyframeCount * stateSize;
+    if (ok && keyframesSize > 0)
+        ok = fwrite(p_movie->p_keyframes, 1, keyframesSize, p_file) ==
+             keyframesSize;
+
+    return fclose(p_file) == 0 && ok;
+}
+
+bool movie_load(Movie* p_movie, const char* p_path) {
+    *p_movie = (Movie){};
+    FILE* p_file = fopen(p_path, "rb");
+    if (p_file == NULL) return false;
+
+    uint8_t header[HEADER_SIZE];
+    uint64_t version, frameCount, val;
+    if (fread(header, 1, HEADER_SIZE, p_file) != HEADER_SIZE ||
+        memcmp(header, MOVIE_MAGIC, 4) != 0) {
+        fclose(p_file);
+        return false;
+    }
+    const uint8_t* p_buf = bytes_get(header + 4, &version, 2);
+    p_buf = bytes_get(p_buf + 2, &val, 4);
+    p_movie->emulationFreq = val;
+    p_buf = bytes_get(p_buf, &val, 4);
+    p_movie->seed = val;
+    p_buf = bytes_get(p_buf, &val, 4);
+    p_movie->keyframeInterval = val;
+    bytes_get(p_buf, &frameCount, 4);
+    if (version != MOVIE_VERSION || p_movie->keyframeInterval == 0) {
+        fclose(p_file);
+        return false;
+    }
+
+    size_t stateSize = cchip8_serializedStateSize();
+    // Allocate at least one frame so that empty movies can still be recorded
+    // onto
+    size_t capacity = frameCount > 0 ? frameCount : 1;
+    p_movie->frameCount = frameCount;
+    p_movie->frameCapacity = capacity;
+    p_movie->keyframeCount = frameCount / p_movie->keyframeInterval;
+    p_movie->p_initialState = malloc(stateSize);
+    p_movie->p_keys = malloc(capacity * sizeof(uint16_t));
+    p_movie->p_displayHashes = malloc(capacity * sizeof(uint64_t));
+    p_movie->p_keyframes = malloc(p_movie->keyframeCount * stateSize + 1);
+
+    bool ok = p_movie->p_initialState != NULL && p_movie->p_keys != NULL &&
+              p_movie->p_displayHashes != NULL &&
+              p_movie->p_keyframes != NULL &&
+              fread(p_movie->p_initialState, 1, stateSize, p_file) ==
+                  stateSize;
+
+    for (size_t i = 0; ok && i < frameCount; i++) {
+        uint8_t frame[FRAME_SIZE];
+        ok = fread(frame, 1, FRAME_SIZE, p_file) == FRAME_SIZE;
+        p_buf = bytes_get(frame, &val, 2);
+        p_movie->p_keys[i] = val;
+        bytes_get(p_buf, &p_movie->p_displayHashes[i], 8);
+    }
+
+    size_t keyframesSize = p_movie->keyframeCount * stateSize;
+    if (ok)
+        ok = fread(p_movie->p_keyframes, 1, keyframesSize, p_file) ==
+             keyframesSize;
+
+    fclose(p_file);
+
+    // Files can't be trusted, so check that every state can be restored
+    Cchip8Envs* p_envs = ok ? cchip8_create(1, NULL, 0, 0, NULL, 0) : NULL;
+    ok = p_envs != NULL &&
+         cchip8_deserializeState(p_envs, 0, p_movie->p_initialState);
+    for (size_t i = 0; ok && i < p_movie->keyframeCount; i++)
+        ok = cchip8_deserializeState(
+            p_envs, 0, &p_movie->p_keyframes[i * stateSize]);
+    if (p_envs != NULL) cchip8_destroy(p_envs);
+
+    if (!ok) movie_free(p_movie);
+    return ok;
+}
+
+
+/* PLAYBACK */
+
+/// Emulates frame `frame` of the movie
+static void stepFrame(const Movie* p_movie,
+                      Cchip8Envs* p_envs,
+                      size_t env,
+                      size_t frame) {
+    cchip8_setInstructionsPerFrame(
+        p_envs, cchip8_frameBudget(p_movie->emulationFreq, frame));
+    cchip8_stepOne(p_envs, env, p_movie->p_keys[frame]);
+}
+
+/// Restores the nearest state at or before `frame` and returns its frame
+static size_t restoreNearest(const Movie* p_movie,
+                             Cchip8Envs* p_envs,
+                             size_t env,
+                             size_t frame) {
+    size_t keyframe = frame / p_movie->keyframeInterval;
+    if (keyframe > p_movie->keyframeCount) keyframe = p_movie->keyframeCount;
+
+    if (keyframe == 0) {
+        cchip8_deserializeState(p_envs, env, p_movie->p_initialState);
+        return 0;
+    }
+
+    cchip8_deserializeState(
+        p_envs,
+        env,
+        &p_movie->p_keyframes[(keyframe - 1) * cchip8_serializedStateSize()]);
+    return keyframe * p_movie->keyframeInterval;
+}
+
+bool movie_seek(const Movie* p_movie,
+                Cchip8Envs* p_envs,
+                size_t env,
+                size_t frame) {
+    if (frame > p_movie->frameCount) return false;
+
+    for (size_t i = restoreNearest(p_movie, p_envs, env, frame); i < frame;
+         i++)
+        stepFrame(p_movie, p_envs, env, i);
+
+    return true;
+}
+
+size_t movie_verify(const Movie* p_movie, Cchip8Envs* p_envs, size_t env) {
+    size_t stateSize = cchip8_serializedStateSize();
+    uint8_t state[stateSize];
+
+    cchip8_deserializeState(p_envs, env, p_movie->p_initialState);
+    size_t divergedFrame = 0;
+    for (size_t i = 0; i < p_movie->frameCount; i++) {
+        stepFrame(p_movie, p_envs, env, i);
+        if (movie_displayHash(p_envs, env) != p_movie->p_displayHashes[i]) {
+            divergedFrame = i + 1;
+            break;
+        }
+
+        // The display can match while the rest of the state has diverged
+        if ((i + 1) % p_movie->keyframeInterval == 0) {
+            size_t keyframe = (i + 1) / p_movie->keyframeInterval - 1;
+            cchip8_serializeState(p_envs, env, state);
+            if (memcmp(state,
+                       &p_movie->p_keyframes[keyframe * stateSize],
+                       stateSize) != 0) {
+                divergedFrame = i + 1;
+                break;
+            }
+        }
+    }
+
+    // Seeking restores a keyframe instead of replaying from the start, and has
+    // to reach the same state
+    if (divergedFrame == 0 && p_movie->frameCount > 0) {
+        uint8_t seekState[stateSize];
+        cchip8_serializeState(p_envs, env, state);
+        movie_seek(p_movie, p_envs, env, p_movie->frameCount);
+        cchip8_serializeState(p_envs, env, seekState);
+        if (memcmp(state, seekState, stateSize) != 0)
+            divergedFrame = p_movie->frameCount;
+    }
+
+    return divergedFrame;
+}
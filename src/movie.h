@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libcchip8.h"
+
+/**
+ * An input movie, for deterministic replays.
+ *
+ * Holds the state the recording started from, the keys held during each frame
+ * and a hash of the display after each frame. Every `keyframeInterval` frames
+ * the full state is stored as well, so that seeking only has to emulate the
+ * frames since the last keyframe.
+ *
+ * All states are stored with `cchip8_serializeState`.
+ */
+typedef struct Movie {
+    /// Instructions per second, frame `i` executes `cchip8_frameBudget` of them
+    uint32_t emulationFreq;
+    /// The seed of the random number generator when the recording started
+    uint32_t seed;
+    uint32_t keyframeInterval;
+
+    uint8_t* p_initialState;
+
+    uint16_t* p_keys;
+    uint64_t* p_displayHashes;
+    size_t frameCount;
+    size_t frameCapacity;
+
+    /// Keyframe `i` is the state after `(i + 1) * keyframeInterval` frames
+    uint8_t* p_keyframes;
+    size_t keyframeCount;
+} Movie;
+
+/**
+ * Starts recording environment `env` from its current state.
+ *
+ * @param p_movie           The movie to record into
+ * @param p_envs            The environments, stepped with the budgets from
+ *                          `cchip8_frameBudget`, counting frames from here
+ * @param env               The environment to record
+ * @param emulationFreq     The instructions per second
+ * @param seed              The seed the environment was given
+ * @param keyframeInterval  How many frames apart keyframes are stored
+ *
+ * @returns Whether there was enough memory
+ */
+bool movie_startRecording(Movie* p_movie,
+                          const Cchip8Envs* p_envs,
+                          size_t env,
+                          uint32_t emulationFreq,
+                          uint32_t seed,
+                          uint32_t keyframeInterval);
+
+/**
+ * Records a frame, should be called right after stepping environment `env`.
+ *
+ * @param keys  The keys the frame was stepped with
+ *
+ * @returns Whether there was enough memory
+ */
+bool movie_recordFrame(Movie* p_movie,
+                       const Cchip8Envs* p_envs,
+                       size_t env,
+                       uint16_t keys);
+
+/// @returns Whether `p_movie` could be written to `p_path`
+bool movie_save(const Movie* p_movie, const char* p_path);
+
+/// @returns Whether a valid movie could be read from `p_path`
+bool movie_load(Movie* p_movie, const char* p_path);
+
+/// Frees the memory held by `p_movie`
+void movie_free(Movie* p_movie);
+
+/// @returns A hash of the display of environment `env`
+uint64_t movie_displayHash(const Cchip8Envs* p_envs, size_t env);
+
+/**
+ * Puts environment `env` into the state after `frame` frames of the movie.
+ *
+ * Restores the nearest keyframe before `frame` and emulates the rest.
+ *
+ * @returns Whether `frame` is within the movie
+ */
+bool movie_seek(const Movie* p_movie,
+                Cchip8Envs* p_envs,
+                size_t env,
+                size_t frame);
+
+/**
+ * Replays the whole movie on environment `env`, checking every display hash
+ * and keyframe, then checks that seeking to the end reaches the same state.
+ *
+ * @returns The first frame (counting from 1) after which the replay diverged,
+ *          or 0 if it matched throughout
+ */
+size_t movie_verify(const Movie* p_movie, Cchip8Envs* p_envs, size_t env);
@@ -0,0 +1,264 @@
+/*
+ * Replays and verifies input movies recorded with `cchip8-term -r`.
+ *
+ * `verify` replays every movie given, and every `*.c8m` movie in the
+ * directories given, across worker threads, reporting the first frame after
+ * which a replay's display or keyframe differs from the recording. It exits
+ * unsuccessfully if any movie diverged or could not be read, for use in
+ * regression tests.
+ *
+ * `seek` prints the display after a given frame, restoring the nearest
+ * keyframe instead of replaying the whole movie.
+ */
+
+// For `sysconf` and `d_type`
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libcchip8.h"
+#include "movie.h"
+
+#define VERSION "0.1.0"
+#define PROG_NAME "cchip8-replay"
+
+
+#define MOVIE_EXTENSION ".c8m"
+
+
+typedef struct Result {
+    char* p_path;
+    bool loaded;
+    size_t frameCount;
+    /// The first frame that diverged, 0 if none did
+    size_t divergedFrame;
+} Result;
+
+Result* g_results = NULL;
+size_t g_resultCount = 0;
+size_t g_resultCapacity = 0;
+
+// The index of the next movie to verify
+atomic_size_t g_nextResult = 0;
+
+
+/* MOVIES */
+
+/// Creates an environment for replaying `p_movie`, at its initial state
+Cchip8Envs* createEnvs(const Movie* p_movie) {
+    // The ROM is part of the initial state's RAM
+    // The instructions per frame are set for every frame replayed
+    Cchip8Envs* p_envs = cchip8_create(1, NULL, 0, 0, NULL, 0);
+    if (p_envs != NULL &&
+        !cchip8_deserializeState(p_envs, 0, p_movie->p_initialState)) {
+        cchip8_destroy(p_envs);
+        return NULL;
+    }
+    return p_envs;
+}
+
+bool addResult(const char* p_path) {
+    if (g_resultCount == g_resultCapacity) {
+        size_t capacity = g_resultCapacity > 0 ? g_resultCapacity * 2 : 16;
+        Result* p_results = realloc(g_results, capacity * sizeof(Result));
+        if (p_results == NULL) return false;
+        g_results = p_results;
+        g_resultCapacity = capacity;
+    }
+
+    g_results[g_resultCount] = (Result){.p_path = strdup(p_path)};
+    return g_results[g_resultCount++].p_path != NULL;
+}
+
+/// Adds the movie at `p_path`, or every movie in it if it is a directory
+bool addMovies(const char* p_path) {
+    DIR* p_dir = opendir(p_path);
+    if (p_dir == NULL) return addResult(p_path);
+
+    struct dirent* p_entry;
+    while ((p_entry = readdir(p_dir)) != NULL) {
+        size_t len = strlen(p_entry->d_name);
+        size_t extLen = strlen(MOVIE_EXTENSION);
+        if (p_entry->d_type == DT_DIR || len <= extLen ||
+            strcmp(&p_entry->d_name[len - extLen], MOVIE_EXTENSION) != 0)
+            continue;
+
+        char path[strlen(p_path) + len + 2];
+        sprintf(path, "%s/%s", p_path, p_entry->d_name);
+        if (!addResult(path)) {
+            closedir(p_dir);
+            return false;
+        }
+    }
+
+    closedir(p_dir);
+    return true;
+}
+
+int compareResults(const void* p_a, const void* p_b) {
+    return strcmp(((const Result*)p_a)->p_path, ((const Result*)p_b)->p_path);
+}
+
+void* verifyWorker(void* p_arg) {
+    (void)p_arg;
+
+    size_t i;
+    while ((i = atomic_fetch_add(&g_nextResult, 1)) < g_resultCount) {
+        Result* p_result = &g_results[i];
+
+        Movie movie;
+        if (!movie_load(&movie, p_result->p_path)) continue;
+        Cchip8Envs* p_envs = createEnvs(&movie);
+        if (p_envs != NULL) {
+            p_result->loaded = true;
+            p_result->frameCount = movie.frameCount;
+            p_result->divergedFrame = movie_verify(&movie, p_envs, 0);
+            cchip8_destroy(p_envs);
+        }
+        movie_free(&movie);
+    }
+
+    return NULL;
+}
+
+
+/* COMMANDS */
+
+int info(const char* p_path) {
+    Movie movie;
+    if (!movie_load(&movie, p_path)) {
+        fprintf(stderr, "Movie could not be read\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Frames:                 %zu\n", movie.frameCount);
+    printf("Emulation frequency:    %u Hz\n", movie.emulationFreq);
+    printf("Seed:                   0x%08X\n", movie.seed);
+    printf("Keyframe interval:      %u\n", movie.keyframeInterval);
+    printf("Keyframes:              %zu\n", movie.keyframeCount);
+
+    movie_free(&movie);
+    return EXIT_SUCCESS;
+}
+
+int seek(const char* p_path, size_t frame) {
+    Movie movie;
+    if (!movie_load(&movie, p_path)) {
+        fprintf(stderr, "Movie could not be read\n");
+        return EXIT_FAILURE;
+    }
+    Cchip8Envs* p_envs = createEnvs(&movie);
+    if (p_envs == NULL) {
+        movie_free(&movie);
+        return EXIT_FAILURE;
+    }
+
+    bool inMovie = movie_seek(&movie, p_envs, 0, frame);
+    if (inMovie) {
+        const uint64_t* p_display = cchip8_framebuffers(p_envs);
+        for (int y = 0; y < 32; y++) {
+            char line[65] = {};
+            for (int x = 0; x < 64; x++)
+                line[x] = p_display[y] >> (63 - x) & 0b1 ? '#' : '.';
+            printf("%s\n", line);
+        }
+    } else {
+        fprintf(
+            stderr, "The movie is only %zu frames long\n", movie.frameCount);
+    }
+
+    cchip8_destroy(p_envs);
+    movie_free(&movie);
+    return inMovie ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int verify(size_t threadCount) {
+    // Directories are listed in no particular order
+    qsort(g_results, g_resultCount, sizeof(Result), &compareResults);
+
+    if (threadCount > g_resultCount) threadCount = g_resultCount;
+    pthread_t* p_threads = calloc(threadCount, sizeof(*p_threads));
+    if (p_threads == NULL && threadCount > 0) return EXIT_FAILURE;
+    for (size_t i = 0; i < threadCount; i++)
+        pthread_create(&p_threads[i], NULL, &verifyWorker, NULL);
+    for (size_t i = 0; i < threadCount; i++) pthread_join(p_threads[i], NULL);
+    free(p_threads);
+
+    size_t failures = 0;
+    for (size_t i = 0; i < g_resultCount; i++) {
+        const Result* p_result = &g_results[i];
+        if (!p_result->loaded) {
+            printf("%s: could not be read\n", p_result->p_path);
+            failures++;
+        } else if (p_result->divergedFrame > 0) {
+            printf("%s: diverged at frame %zu of %zu\n",
+                   p_result->p_path,
+                   p_result->divergedFrame,
+                   p_result->frameCount);
+            failures++;
+        } else {
+            printf("%s: ok, %zu frames\n",
+                   p_result->p_path,
+                   p_result->frameCount);
+        }
+        free(p_result->p_path);
+    }
+
+    printf("\n%zu of %zu movies passed\n",
+           g_resultCount - failures,
+           g_resultCount);
+    free(g_results);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* MAIN */
+
+void printUsage() {
+    printf("Usage: %s info movie_file\n", PROG_NAME);
+    printf("       %s seek movie_file frame\n", PROG_NAME);
+    printf("       %s verify [-j threads] movie_file_or_dir...\n", PROG_NAME);
+    printf("  -j  Number of worker threads, defaults to the number of CPUs\n");
+}
+
+int main(int argc, char* p_argv[]) {
+    printf("%s version %s\n\n", PROG_NAME, VERSION);
+
+    if (argc == 3 && strcmp(p_argv[1], "info") == 0) return info(p_argv[2]);
+    if (argc == 4 && strcmp(p_argv[1], "seek") == 0)
+        return seek(p_argv[2], strtoull(p_argv[3], NULL, 0));
+    if (argc < 3 || strcmp(p_argv[1], "verify") != 0) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    size_t threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    // Skip the subcommand
+    optind = 2;
+    int opt;
+    while ((opt = getopt(argc, p_argv, "j:")) != -1) {
+        switch (opt) {
+            case 'j':
+                threadCount = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                printUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc || threadCount == 0) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; i++)
+        if (!addMovies(p_argv[i])) return EXIT_FAILURE;
+
+    return verify(threadCount);
+}
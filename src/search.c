@@ -0,0 +1,619 @@
+/*
+ * Parallel state space search for inputs reaching a target.
+ *
+ * Starting from the freshly loaded ROM, a key choice is made every
+ * `decision_frames` frames. The search goes breadth first, one decision at a
+ * time, so the first input found reaching the target is the shortest one
+ * among the states explored. Each level keeps at most `beam_width` states,
+ * preferring the ones with the highest score, and states already visited
+ * (same RAM, registers and display) are dropped.
+ *
+ * Expanding a level is spread over worker threads that each own a libcchip8
+ * environment. Every worker starts with an even share of the states to expand
+ * and steals half of another worker's remaining share when it runs out.
+ *
+ * The score and target are read from RAM, either as the 3 digit BCD number
+ * `FX33` writes to an address, a single byte, or by a plugin exporting:
+ *
+ *     int64_t cchip8_search_score(const uint8_t ram[4096]);
+ *     // Optional, defaults to `score >= goal`
+ *     bool cchip8_search_target(const uint8_t ram[4096]);
+ *
+ * The input found is printed as `frames keys` lines, both in hex, meaning the
+ * keys held for that many frames.
+ */
+
+// For `sysconf`
+#define _DEFAULT_SOURCE
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libcchip8.h"
+
+#define VERSION "0.1.0"
+#define PROG_NAME "cchip8-search"
+
+
+#define MAX_CHOICES 17
+// Smallest visited set, in log2 slots
+#define MIN_VISITED_BITS 16
+
+
+/// How a state was reached from the previous level
+typedef struct Link {
+    uint32_t parent;
+    uint8_t choice;
+} Link;
+
+typedef struct Child {
+    Link link;
+    uint64_t hash;
+    int64_t score;
+    bool isTarget;
+} Child;
+
+typedef struct ChildList {
+    Child* p_children;
+    size_t count;
+    size_t capacity;
+} ChildList;
+
+/// A range of states still to be expanded by a worker
+typedef struct Share {
+    pthread_mutex_t mutex;
+    size_t start;
+    size_t end;
+} Share;
+
+typedef enum Phase {
+    PHASE_EXPAND,
+    PHASE_MATERIALISE,
+    PHASE_EXIT,
+} Phase;
+
+
+/* OPTIONS */
+
+uint8_t g_rom[CCHIP8_MAX_ROM_SIZE];
+size_t g_romSize = 0;
+uint32_t g_instructionsPerFrame = 8;
+uint32_t g_decisionFrames = 10;
+size_t g_beamWidth = 4096;
+size_t g_maxDepth = 1000;
+int64_t g_goal = 1;
+
+// The key masks to choose from at each decision
+uint16_t g_choices[MAX_CHOICES];
+size_t g_choiceCount = 0;
+
+typedef enum ScoreKind {
+    SCORE_BCD,
+    SCORE_BYTE,
+    SCORE_PLUGIN,
+} ScoreKind;
+ScoreKind g_scoreKind = SCORE_BCD;
+uint16_t g_scoreAddr = 0;
+int64_t (*gp_pluginScore)(const uint8_t* p_ram) = NULL;
+bool (*gp_pluginTarget)(const uint8_t* p_ram) = NULL;
+
+
+/* SEARCH STATE */
+
+size_t g_threadCount = 1;
+pthread_barrier_t g_startBarrier;
+pthread_barrier_t g_endBarrier;
+Phase g_phase = PHASE_EXPAND;
+
+size_t g_stateSize = 0;
+// States of the current level, and of the next level while materialising
+uint8_t* gp_frontier = NULL;
+uint8_t* gp_nextFrontier = NULL;
+size_t g_frontierCount = 0;
+
+Share* gp_shares = NULL;
+ChildList* gp_childLists = NULL;
+
+// The children that make it into the next level
+Child* gp_selected = NULL;
+size_t g_selectedCount = 0;
+atomic_size_t g_nextToMaterialise = 0;
+
+// Open addressing set of state hashes, 0 marks an empty slot
+_Atomic uint64_t* gp_visited = NULL;
+size_t g_visitedBits = 0;
+size_t g_visitedCount = 0;
+atomic_size_t g_levelVisitedCount = 0;
+
+
+/* SCORING */
+
+int64_t score(const uint8_t* p_ram) {
+    switch (g_scoreKind) {
+        case SCORE_BCD:
+            return p_ram[g_scoreAddr] * 100 + p_ram[g_scoreAddr + 1] * 10 +
+                   p_ram[g_scoreAddr + 2];
+        case SCORE_BYTE:
+            return p_ram[g_scoreAddr];
+        case SCORE_PLUGIN:
+            return gp_pluginScore(p_ram);
+    }
+    return 0;
+}
+
+bool isTarget(const uint8_t* p_ram, int64_t score) {
+    if (gp_pluginTarget != NULL) return gp_pluginTarget(p_ram);
+    return score >= g_goal;
+}
+
+
+/* VISITED STATES */
+
+/// @returns Whether `hash` hadn't been visited before
+bool visit(uint64_t hash) {
+    // Keep 0 free to mark empty slots
+    if (hash == 0) hash = 1;
+
+    size_t mask = ((size_t)1 << g_visitedBits) - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        uint64_t expected = 0;
+        if (atomic_compare_exchange_strong(
+                &gp_visited[slot], &expected, hash)) {
+            atomic_fetch_add_explicit(
+                &g_levelVisitedCount, 1, memory_order_relaxed);
+            return true;
+        }
+        if (expected == hash) return false;
+    }
+}
+
+/// Makes room for `extra` more hashes, keeping the set at most half full
+bool reserveVisited(size_t extra) {
+    size_t needed = (g_visitedCount + extra) * 2;
+    if (g_visitedBits >= MIN_VISITED_BITS &&
+        ((size_t)1 << g_visitedBits) >= needed)
+        return true;
+
+    size_t bits = g_visitedBits > MIN_VISITED_BITS ? g_visitedBits
+                                                   : MIN_VISITED_BITS;
+    while (((size_t)1 << bits) < needed) bits++;
+
+    _Atomic uint64_t* p_oldVisited = gp_visited;
+    size_t oldSize = p_oldVisited != NULL ? (size_t)1 << g_visitedBits : 0;
+    gp_visited = calloc((size_t)1 << bits, sizeof(*gp_visited));
+    if (gp_visited == NULL) return false;
+    g_visitedBits = bits;
+
+    size_t count = g_visitedCount;
+    for (size_t i = 0; i < oldSize; i++)
+        if (p_oldVisited[i] != 0) visit(p_oldVisited[i]);
+    g_visitedCount = count;
+    atomic_store(&g_levelVisitedCount, 0);
+    free(p_oldVisited);
+
+    return true;
+}
+
+
+/* WORKERS */
+
+void stepFrames(Cchip8Envs* p_envs, uint16_t keys) {
+    for (uint32_t f = 0; f < g_decisionFrames; f++)
+        cchip8_stepOne(p_envs, 0, keys);
+}
+
+bool pushChild(ChildList* p_list, Child child) {
+    if (p_list->count == p_list->capacity) {
+        size_t capacity = p_list->capacity ? p_list->capacity * 2 : 256;
+        Child* p_children =
+            realloc(p_list->p_children, capacity * sizeof(Child));
+        if (p_children == NULL) return false;
+        p_list->p_children = p_children;
+        p_list->capacity = capacity;
+    }
+
+    p_list->p_children[p_list->count++] = child;
+    return true;
+}
+
+/// Takes a state to expand from the worker's own share, or steals half of
+/// another worker's share
+bool takeWork(size_t worker, size_t* p_idx) {
+    Share* p_share = &gp_shares[worker];
+
+    pthread_mutex_lock(&p_share->mutex);
+    if (p_share->start < p_share->end) {
+        *p_idx = --p_share->end;
+        pthread_mutex_unlock(&p_share->mutex);
+        return true;
+    }
+    pthread_mutex_unlock(&p_share->mutex);
+
+    for (size_t i = 1; i < g_threadCount; i++) {
+        Share* p_victim = &gp_shares[(worker + i) % g_threadCount];
+
+        pthread_mutex_lock(&p_victim->mutex);
+        size_t remaining = p_victim->end - p_victim->start;
+        if (remaining == 0) {
+            pthread_mutex_unlock(&p_victim->mutex);
+            continue;
+        }
+        size_t start = p_victim->start;
+        size_t stolen = (remaining + 1) / 2;
+        p_victim->start += stolen;
+        pthread_mutex_unlock(&p_victim->mutex);
+
+        // Keep one for now, put the rest where others can steal it back
+        pthread_mutex_lock(&p_share->mutex);
+        p_share->start = start;
+        p_share->end = start + stolen - 1;
+        pthread_mutex_unlock(&p_share->mutex);
+        *p_idx = start + stolen - 1;
+        return true;
+    }
+
+    return false;
+}
+
+void expand(size_t worker, Cchip8Envs* p_envs) {
+    ChildList* p_list = &gp_childLists[worker];
+    p_list->count = 0;
+
+    size_t idx;
+    while (takeWork(worker, &idx)) {
+        const uint8_t* p_state = &gp_frontier[idx * g_stateSize];
+
+        for (size_t choice = 0; choice < g_choiceCount; choice++) {
+            cchip8_loadState(p_envs, 0, p_state);
+            stepFrames(p_envs, g_choices[choice]);
+            uint64_t hash = cchip8_hash(p_envs, 0);
+            if (!visit(hash)) continue;
+
+            const uint8_t* p_ram = cchip8_ram(p_envs, 0);
+            int64_t childScore = score(p_ram);
+            pushChild(p_list,
+                      (Child){
+                          .link = {.parent = idx, .choice = choice},
+                          .hash = hash,
+                          .score = childScore,
+                          .isTarget = isTarget(p_ram, childScore),
+                      });
+        }
+    }
+}
+
+void materialise(Cchip8Envs* p_envs) {
+    size_t i;
+    while ((i = atomic_fetch_add(&g_nextToMaterialise, 1)) < g_selectedCount) {
+        Link link = gp_selected[i].link;
+        cchip8_loadState(
+            p_envs, 0, &gp_frontier[(size_t)link.parent * g_stateSize]);
+        stepFrames(p_envs, g_choices[link.choice]);
+        cchip8_saveState(p_envs, 0, &gp_nextFrontier[i * g_stateSize]);
+    }
+}
+
+void* searchWorker(void* p_arg) {
+    size_t worker = (uintptr_t)p_arg;
+
+    Cchip8Envs* p_envs = cchip8_create(
+        1, g_rom, g_romSize, g_instructionsPerFrame, NULL, 0);
+    if (p_envs == NULL) {
+        fprintf(stderr, "Couldn't create search environment\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (true) {
+        pthread_barrier_wait(&g_startBarrier);
+        if (g_phase == PHASE_EXIT) break;
+
+        if (g_phase == PHASE_EXPAND)
+            expand(worker, p_envs);
+        else
+            materialise(p_envs);
+        pthread_barrier_wait(&g_endBarrier);
+    }
+
+    cchip8_destroy(p_envs);
+    return NULL;
+}
+
+void runPhase(Phase phase) {
+    g_phase = phase;
+    pthread_barrier_wait(&g_startBarrier);
+    if (phase != PHASE_EXIT) pthread_barrier_wait(&g_endBarrier);
+}
+
+
+/* LEVELS */
+
+/// Orders by descending score. Ties are broken by hash, which spreads the
+/// states kept over the whole level, and then by how the state was reached so
+/// that the result doesn't depend on thread timing.
+int compareChildren(const void* p_a, const void* p_b) {
+    const Child* p_childA = p_a;
+    const Child* p_childB = p_b;
+
+    if (p_childA->score != p_childB->score)
+        return p_childA->score > p_childB->score ? -1 : 1;
+    if (p_childA->hash != p_childB->hash)
+        return p_childA->hash < p_childB->hash ? -1 : 1;
+    if (p_childA->link.parent != p_childB->link.parent)
+        return p_childA->link.parent < p_childB->link.parent ? -1 : 1;
+    return (int)p_childA->link.choice - (int)p_childB->link.choice;
+}
+
+void printPath(Link** pp_levels, size_t depth, Link last) {
+    uint8_t* p_choices = malloc(depth + 1);
+    if (p_choices == NULL) return;
+
+    p_choices[depth] = last.choice;
+    uint32_t parent = last.parent;
+    for (size_t level = depth; level-- > 0;) {
+        p_choices[level] = pp_levels[level][parent].choice;
+        parent = pp_levels[level][parent].parent;
+    }
+
+    // Merge consecutive decisions holding the same keys
+    for (size_t i = 0; i <= depth;) {
+        size_t run = 1;
+        while (i + run <= depth && p_choices[i + run] == p_choices[i]) run++;
+        printf("%lX %04X\n",
+               (uint64_t)run * g_decisionFrames,
+               g_choices[p_choices[i]]);
+        i += run;
+    }
+
+    free(p_choices);
+}
+
+/// @returns Whether the target was reached
+bool search() {
+    g_stateSize = cchip8_stateSize();
+    gp_frontier = malloc(g_beamWidth * g_stateSize);
+    gp_nextFrontier = malloc(g_beamWidth * g_stateSize);
+    gp_shares = calloc(g_threadCount, sizeof(*gp_shares));
+    gp_childLists = calloc(g_threadCount, sizeof(*gp_childLists));
+    gp_selected = malloc(g_beamWidth * sizeof(*gp_selected));
+    // The links of the states in each level, for walking back the path
+    Link** pp_levels = calloc(g_maxDepth, sizeof(*pp_levels));
+    if (gp_frontier == NULL || gp_nextFrontier == NULL || gp_shares == NULL ||
+        gp_childLists == NULL || gp_selected == NULL || pp_levels == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+    for (size_t i = 0; i < g_threadCount; i++)
+        pthread_mutex_init(&gp_shares[i].mutex, NULL);
+
+    Cchip8Envs* p_envs = cchip8_create(
+        1, g_rom, g_romSize, g_instructionsPerFrame, NULL, 0);
+    if (p_envs == NULL) return false;
+    cchip8_saveState(p_envs, 0, gp_frontier);
+    g_frontierCount = 1;
+    cchip8_destroy(p_envs);
+
+    int64_t bestScore = INT64_MIN;
+    for (size_t depth = 0; depth < g_maxDepth; depth++) {
+        if (!reserveVisited(g_frontierCount * g_choiceCount)) {
+            fprintf(stderr, "Out of memory\n");
+            return false;
+        }
+
+        // Give every worker an even share of the level to start with
+        for (size_t i = 0; i < g_threadCount; i++) {
+            gp_shares[i].start = g_frontierCount * i / g_threadCount;
+            gp_shares[i].end = g_frontierCount * (i + 1) / g_threadCount;
+        }
+        runPhase(PHASE_EXPAND);
+        g_visitedCount += atomic_exchange(&g_levelVisitedCount, 0);
+
+        // Gather the children of every worker
+        size_t childCount = 0;
+        for (size_t i = 0; i < g_threadCount; i++)
+            childCount += gp_childLists[i].count;
+        if (childCount == 0) {
+            fprintf(stderr, "\n");
+            printf("Ran out of new states after %zu decisions\n", depth);
+            return false;
+        }
+        Child* p_children = malloc(childCount * sizeof(Child));
+        if (p_children == NULL) return false;
+        childCount = 0;
+        for (size_t i = 0; i < g_threadCount; i++) {
+            memcpy(&p_children[childCount],
+                   gp_childLists[i].p_children,
+                   gp_childLists[i].count * sizeof(Child));
+            childCount += gp_childLists[i].count;
+        }
+        qsort(p_children, childCount, sizeof(Child), &compareChildren);
+
+        for (size_t i = 0; i < childCount; i++)
+            if (p_children[i].isTarget) {
+                fprintf(stderr, "\n");
+                printf("Reached the target after %zu frames:\n",
+                       (depth + 1) * g_decisionFrames);
+                printPath(pp_levels, depth, p_children[i].link);
+                return true;
+            }
+
+        if (p_children[0].score > bestScore) bestScore = p_children[0].score;
+        fprintf(stderr,
+                "\rDecision %zu: %zu new states, %zu visited, best score "
+                "%li   ",
+                depth + 1,
+                childCount,
+                g_visitedCount,
+                bestScore);
+
+        // Keep the best scoring children for the next level
+        g_selectedCount =
+            childCount < g_beamWidth ? childCount : g_beamWidth;
+        memcpy(gp_selected, p_children, g_selectedCount * sizeof(Child));
+        free(p_children);
+
+        pp_levels[depth] = malloc(g_selectedCount * sizeof(Link));
+        if (pp_levels[depth] == NULL) return false;
+        for (size_t i = 0; i < g_selectedCount; i++)
+            pp_levels[depth][i] = gp_selected[i].link;
+
+        atomic_store(&g_nextToMaterialise, 0);
+        runPhase(PHASE_MATERIALISE);
+
+        uint8_t* p_frontier = gp_frontier;
+        gp_frontier = gp_nextFrontier;
+        gp_nextFrontier = p_frontier;
+        g_frontierCount = g_selectedCount;
+    }
+
+    fprintf(stderr, "\n");
+    printf("Didn't reach the target within %zu decisions\n", g_maxDepth);
+    return false;
+}
+
+
+/* MAIN */
+
+bool parseChoices(char* p_list) {
+    g_choiceCount = 0;
+    for (char* p_key = strtok(p_list, ","); p_key != NULL;
+         p_key = strtok(NULL, ",")) {
+        if (g_choiceCount == MAX_CHOICES) return false;
+
+        if (strcmp(p_key, "-") == 0) {
+            g_choices[g_choiceCount++] = 0;
+            continue;
+        }
+        char* p_end;
+        long key = strtol(p_key, &p_end, 16);
+        if (*p_end != '\0' || key < 0 || key > 0xF) return false;
+        g_choices[g_choiceCount++] = 1u << key;
+    }
+
+    return g_choiceCount > 0;
+}
+
+bool loadPlugin(const char* p_path) {
+    void* p_plugin = dlopen(p_path, RTLD_NOW);
+    if (p_plugin == NULL) {
+        fprintf(stderr, "Couldn't load plugin: %s\n", dlerror());
+        return false;
+    }
+
+    gp_pluginScore = dlsym(p_plugin, "cchip8_search_score");
+    gp_pluginTarget = dlsym(p_plugin, "cchip8_search_target");
+    if (gp_pluginScore == NULL) {
+        fprintf(stderr, "Plugin doesn't export cchip8_search_score\n");
+        return false;
+    }
+
+    g_scoreKind = SCORE_PLUGIN;
+    return true;
+}
+
+void printUsage() {
+    printf("Usage: %s [options] (-s addr | -S addr | -p plugin) rom_file\n",
+           PROG_NAME);
+    printf("  -s addr       Score by the BCD number at addr, as FX33 stores "
+           "it\n");
+    printf("  -S addr       Score by the byte at addr\n");
+    printf("  -p plugin     Score with a plugin shared library\n");
+    printf("  -g goal       Stop at this score, defaults to 1\n");
+    printf("  -k keys       Comma separated hex keys to choose from, - for no "
+           "key,\n");
+    printf("                defaults to -,0,1,...,F\n");
+    printf("  -d frames     Frames between decisions, defaults to 10\n");
+    printf("  -m decisions  Maximum decisions, defaults to 1000\n");
+    printf("  -w width      States kept per decision, defaults to 4096\n");
+    printf("  -i ipf        Instructions per frame, defaults to 8\n");
+    printf("  -j threads    Search threads, defaults to one per core\n");
+}
+
+int main(int argc, char* p_argv[]) {
+    printf("%s version %s\n\n", PROG_NAME, VERSION);
+
+    g_threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    g_choices[g_choiceCount++] = 0;
+    for (int key = 0; key < 16; key++) g_choices[g_choiceCount++] = 1u << key;
+
+    bool hasScore = false;
+    int opt;
+    while ((opt = getopt(argc, p_argv, "s:S:p:g:k:d:m:w:i:j:")) != -1) {
+        switch (opt) {
+            case 's':
+            case 'S': {
+                g_scoreKind = opt == 's' ? SCORE_BCD : SCORE_BYTE;
+                // The BCD number takes up 3 bytes, which have to be in RAM
+                unsigned long addr = strtoul(optarg, NULL, 0);
+                if (addr > (opt == 's' ? 4096 - 3 : 4096 - 1)) {
+                    printUsage();
+                    return EXIT_FAILURE;
+                }
+                g_scoreAddr = addr;
+                hasScore = true;
+                break;
+            }
+            case 'p':
+                if (!loadPlugin(optarg)) return EXIT_FAILURE;
+                hasScore = true;
+                break;
+            case 'g':
+                g_goal = strtoll(optarg, NULL, 0);
+                break;
+            case 'k':
+                if (!parseChoices(optarg)) {
+                    printUsage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd':
+                g_decisionFrames = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                g_maxDepth = strtoull(optarg, NULL, 0);
+                break;
+            case 'w':
+                g_beamWidth = strtoull(optarg, NULL, 0);
+                break;
+            case 'i':
+                g_instructionsPerFrame = strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                g_threadCount = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                printUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || !hasScore || g_decisionFrames == 0 ||
+        g_maxDepth == 0 || g_beamWidth == 0 || g_beamWidth > UINT32_MAX ||
+        g_threadCount == 0) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    if (!cchip8_loadRom(p_argv[optind], g_rom, &g_romSize)) {
+        fprintf(stderr, "ROM file could not be opened\n");
+        return EXIT_FAILURE;
+    }
+
+    pthread_barrier_init(&g_startBarrier, NULL, g_threadCount + 1);
+    pthread_barrier_init(&g_endBarrier, NULL, g_threadCount + 1);
+    pthread_t* p_threads = calloc(g_threadCount, sizeof(*p_threads));
+    if (p_threads == NULL) return EXIT_FAILURE;
+    for (size_t i = 0; i < g_threadCount; i++)
+        pthread_create(&p_threads[i], NULL, &searchWorker, (void*)i);
+
+    bool found = search();
+
+    runPhase(PHASE_EXIT);
+    for (size_t i = 0; i < g_threadCount; i++)
+        pthread_join(p_threads[i], NULL);
+
+    return found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
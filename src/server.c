@@ -0,0 +1,531 @@
+/*
+ * Headless frame-delta streaming server.
+ *
+ * Serves one machine per ROM given on the command line over a Unix domain
+ * socket. Any number of clients can attach to a machine to watch it and drive
+ * its keys. All sockets and the 60 Hz frame timer are multiplexed with a single
+ * epoll event loop.
+ *
+ * PROTOCOL
+ *
+ * All multi-byte integers are little endian.
+ *
+ * Client to server messages are always 3 bytes long:
+ *  - `0x01 session divisor`  Attach to (or switch to) machine `session`, and
+ *                            receive every `divisor`-th frame (1 for 60 Hz,
+ *                            2 for 30 Hz, ...). The next frame sent contains
+ *                            every row of the display.
+ *  - `0x02 keys:u16`         Set the keys held by this client. A machine sees
+ *                            the union of the keys held by its clients.
+ *
+ * Server to client messages:
+ *  - `0x81 frame:u32 rows:u32 row:u64...`
+ *                            A frame update. Bit `y` of `rows` is set when row
+ *                            `y` of the display changed since the last frame
+ *                            sent to this client, and one `row` follows for
+ *                            each set bit in ascending order of `y`. Bit
+ *                            `63 - x` of a row is the pixel at `x`.
+ *
+ * Clients that cannot keep up simply skip frames, the next frame they receive
+ * contains every row that changed in the meantime.
+ */
+
+// For `accept4`
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core.h"
+
+#define VERSION "0.1.0"
+#define PROG_NAME "cchip8-server"
+
+
+#define MSG_ATTACH 0x01
+#define MSG_KEYS 0x02
+#define MSG_FRAME 0x81
+
+#define CLIENT_MSG_LEN 3
+// Type, frame number, row mask and every row
+#define MAX_FRAME_MSG_LEN (1 + 4 + 4 + 32 * 8)
+// Enough to queue a handful of full frames for a slow client
+#define CLIENT_OUT_BUF_LEN (MAX_FRAME_MSG_LEN * 16)
+
+// Don't try to make up for more than this many frames when the host stalls
+#define MAX_CATCHUP_FRAMES 4
+#define MAX_EVENTS 64
+// Clients are stored by pointer in their epoll events, which can never be
+// these values
+#define LISTENER_TAG 0
+#define TIMER_TAG 1
+
+
+typedef struct Session {
+    MachineState machineState;
+    uint64_t displayBuffer[32];
+    /// The union of the keys held by every attached client
+    uint16_t heldKeys;
+    uint32_t frame;
+} Session;
+
+typedef struct Client {
+    int fd;
+    /// Index into `gp_clients`
+    size_t idx;
+
+    /// The session being watched, NULL until the client attaches
+    Session* p_session;
+    uint8_t frameDivisor;
+    /// The session frame at or after which the next frame is sent
+    uint32_t nextFrame;
+    uint16_t heldKeys;
+
+    /// The display as of the last frame sent to the client
+    uint64_t sentRows[32];
+    bool needsFullFrame;
+
+    uint8_t inBuf[CLIENT_MSG_LEN];
+    size_t inLen;
+    uint8_t outBuf[CLIENT_OUT_BUF_LEN];
+    size_t outLen;
+    bool waitingForWritable;
+
+    /// Links clients closed during an epoll batch, which may still have
+    /// pending events in that batch
+    struct Client* p_nextClosed;
+} Client;
+
+
+Session* gp_sessions = NULL;
+size_t g_sessionCount = 0;
+
+Client** gp_clients = NULL;
+size_t g_clientCount = 0;
+size_t g_clientCapacity = 0;
+Client* gp_closedClients = NULL;
+
+int g_epollFd = -1;
+uint64_t g_emulationFreq = 500;
+
+
+/* CORE CALLBACKS */
+
+// The session being ticked, the callbacks don't carry any context
+Session* gp_currentSession = NULL;
+
+uint16_t heldKeys() { return gp_currentSession->heldKeys; }
+
+bool getPixel(uint8_t x, uint8_t y) {
+    return gp_currentSession->displayBuffer[y % 32] >> (63 - x % 64) & 0b1;
+}
+void togglePixel(uint8_t x, uint8_t y) {
+    gp_currentSession->displayBuffer[y % 32] ^= 1ull << (63 - x % 64);
+}
+void clearDisplay() {
+    memset(gp_currentSession->displayBuffer,
+           0,
+           sizeof(gp_currentSession->displayBuffer));
+}
+
+void sigIllHandler() {}
+
+
+/* SESSIONS */
+
+bool loadSession(Session* p_session, const char* p_romPath) {
+    *p_session = (Session){};
+    core_init(&p_session->machineState,
+              NULL,
+              NULL,
+              &heldKeys,
+              &getPixel,
+              &togglePixel,
+              &clearDisplay,
+              &sigIllHandler);
+
+    FILE* romFile = fopen(p_romPath, "rb");
+    if (romFile == NULL) {
+        fprintf(stderr, "ROM file %s could not be opened\n", p_romPath);
+        return false;
+    }
+    fread(&p_session->machineState.ram[0x0200],
+          sizeof(*(p_session->machineState.ram)),
+          sizeof(p_session->machineState.ram) - 0x0200,
+          romFile);
+    fclose(romFile);
+
+    return true;
+}
+
+void runSessionFrame(Session* p_session) {
+    gp_currentSession = p_session;
+
+    // Spread the emulation frequency over the frames without drifting
+    uint64_t frame = p_session->frame;
+    uint64_t instructions =
+        (frame + 1) * g_emulationFreq / 60 - frame * g_emulationFreq / 60;
+    for (uint64_t i = 0; i < instructions; i++)
+        core_tick(&p_session->machineState);
+    core_timerTick(&p_session->machineState);
+
+    p_session->frame++;
+}
+
+void updateSessionKeys(Session* p_session) {
+    if (p_session == NULL) return;
+
+    p_session->heldKeys = 0;
+    for (size_t i = 0; i < g_clientCount; i++)
+        if (gp_clients[i]->p_session == p_session)
+            p_session->heldKeys |= gp_clients[i]->heldKeys;
+}
+
+
+/* CLIENTS */
+
+void setWaitingForWritable(Client* p_client, bool waiting) {
+    if (p_client->waitingForWritable == waiting) return;
+    p_client->waitingForWritable = waiting;
+
+    struct epoll_event event = {
+        .events = EPOLLIN | (waiting ? EPOLLOUT : 0),
+        .data.ptr = p_client,
+    };
+    epoll_ctl(g_epollFd, EPOLL_CTL_MOD, p_client->fd, &event);
+}
+
+void closeClient(Client* p_client) {
+    epoll_ctl(g_epollFd, EPOLL_CTL_DEL, p_client->fd, NULL);
+    close(p_client->fd);
+    p_client->fd = -1;
+
+    gp_clients[p_client->idx] = gp_clients[--g_clientCount];
+    gp_clients[p_client->idx]->idx = p_client->idx;
+    updateSessionKeys(p_client->p_session);
+
+    p_client->p_nextClosed = gp_closedClients;
+    gp_closedClients = p_client;
+}
+
+void freeClosedClients() {
+    while (gp_closedClients != NULL) {
+        Client* p_client = gp_closedClients;
+        gp_closedClients = p_client->p_nextClosed;
+        free(p_client);
+    }
+}
+
+/// @returns Whether the client is still connected
+bool flushClient(Client* p_client) {
+    size_t written = 0;
+    while (written < p_client->outLen) {
+        ssize_t count = send(p_client->fd,
+                             &p_client->outBuf[written],
+                             p_client->outLen - written,
+                             MSG_NOSIGNAL);
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            closeClient(p_client);
+            return false;
+        }
+        written += count;
+    }
+
+    memmove(p_client->outBuf,
+            &p_client->outBuf[written],
+            p_client->outLen - written);
+    p_client->outLen -= written;
+    setWaitingForWritable(p_client, p_client->outLen > 0);
+
+    return true;
+}
+
+void acceptClients(int listenFd) {
+    while (true) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+
+        if (g_clientCount == g_clientCapacity) {
+            size_t capacity = g_clientCapacity ? g_clientCapacity * 2 : 64;
+            Client** p_clients =
+                realloc(gp_clients, capacity * sizeof(*gp_clients));
+            if (p_clients == NULL) {
+                close(fd);
+                return;
+            }
+            gp_clients = p_clients;
+            g_clientCapacity = capacity;
+        }
+
+        Client* p_client = calloc(1, sizeof(*p_client));
+        if (p_client == NULL) {
+            close(fd);
+            return;
+        }
+        p_client->fd = fd;
+        p_client->idx = g_clientCount;
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = p_client};
+        if (epoll_ctl(g_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            free(p_client);
+            return;
+        }
+        gp_clients[g_clientCount++] = p_client;
+    }
+}
+
+/// @returns Whether the client is still connected
+bool handleClientMessage(Client* p_client) {
+    uint8_t* p_msg = p_client->inBuf;
+
+    switch (p_msg[0]) {
+        case MSG_ATTACH: {
+            if (p_msg[1] >= g_sessionCount) {
+                closeClient(p_client);
+                return false;
+            }
+
+            Session* p_previousSession = p_client->p_session;
+            p_client->p_session = &gp_sessions[p_msg[1]];
+            p_client->frameDivisor = p_msg[2] ? p_msg[2] : 1;
+            p_client->nextFrame = p_client->p_session->frame;
+            p_client->needsFullFrame = true;
+
+            updateSessionKeys(p_previousSession);
+            updateSessionKeys(p_client->p_session);
+            return true;
+        }
+
+        case MSG_KEYS:
+            p_client->heldKeys = p_msg[1] | p_msg[2] << 8;
+            updateSessionKeys(p_client->p_session);
+            return true;
+    }
+
+    // Unknown message, the stream can't be trusted anymore
+    closeClient(p_client);
+    return false;
+}
+
+void readClient(Client* p_client) {
+    while (true) {
+        ssize_t count = recv(p_client->fd,
+                             &p_client->inBuf[p_client->inLen],
+                             CLIENT_MSG_LEN - p_client->inLen,
+                             0);
+        if (count == 0 ||
+            (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+             errno != EINTR)) {
+            closeClient(p_client);
+            return;
+        }
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        p_client->inLen += count;
+        if (p_client->inLen == CLIENT_MSG_LEN) {
+            p_client->inLen = 0;
+            if (!handleClientMessage(p_client)) return;
+        }
+    }
+}
+
+void putU32(uint8_t* p_buf, uint32_t val) {
+    for (int i = 0; i < 4; i++) p_buf[i] = val >> (8 * i);
+}
+void putU64(uint8_t* p_buf, uint64_t val) {
+    for (int i = 0; i < 8; i++) p_buf[i] = val >> (8 * i);
+}
+
+void queueFrame(Client* p_client) {
+    Session* p_session = p_client->p_session;
+
+    // Skip the frame, the next one sent will include these changes
+    if (CLIENT_OUT_BUF_LEN - p_client->outLen < MAX_FRAME_MSG_LEN) return;
+
+    uint32_t changedRows = 0;
+    for (int y = 0; y < 32; y++)
+        if (p_client->needsFullFrame ||
+            p_client->sentRows[y] != p_session->displayBuffer[y])
+            changedRows |= 1u << y;
+    p_client->needsFullFrame = false;
+
+    uint8_t* p_msg = &p_client->outBuf[p_client->outLen];
+    p_msg[0] = MSG_FRAME;
+    putU32(&p_msg[1], p_session->frame);
+    putU32(&p_msg[5], changedRows);
+    size_t len = 9;
+    for (int y = 0; y < 32; y++)
+        if (changedRows >> y & 0b1) {
+            putU64(&p_msg[len], p_session->displayBuffer[y]);
+            p_client->sentRows[y] = p_session->displayBuffer[y];
+            len += 8;
+        }
+
+    p_client->outLen += len;
+}
+
+void runFrame(int timerFd) {
+    uint64_t expirations = 0;
+    if (read(timerFd, &expirations, sizeof(expirations)) !=
+        sizeof(expirations))
+        return;
+    if (expirations > MAX_CATCHUP_FRAMES) expirations = MAX_CATCHUP_FRAMES;
+
+    for (uint64_t frame = 0; frame < expirations; frame++)
+        for (size_t i = 0; i < g_sessionCount; i++)
+            runSessionFrame(&gp_sessions[i]);
+
+    // Iterate backwards so that closed clients swapped into the current slot
+    // have already been handled
+    for (size_t i = g_clientCount; i-- > 0;) {
+        Client* p_client = gp_clients[i];
+        // Several frames may have run since the last batch, so a multiple of
+        // the divisor can be crossed without being landed on
+        if (p_client->p_session == NULL ||
+            (int32_t)(p_client->p_session->frame - p_client->nextFrame) < 0)
+            continue;
+
+        uint32_t frame = p_client->p_session->frame;
+        p_client->nextFrame =
+            frame - frame % p_client->frameDivisor + p_client->frameDivisor;
+        queueFrame(p_client);
+        if (!p_client->waitingForWritable) flushClient(p_client);
+    }
+}
+
+
+int createListener(const char* p_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(p_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, p_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Couldn't create socket");
+        return -1;
+    }
+
+    unlink(p_path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        perror("Couldn't listen on socket");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int createFrameTimer() {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("Couldn't create frame timer");
+        return -1;
+    }
+
+    struct itimerspec period = {
+        .it_interval = {.tv_nsec = 1000000000 / 60},
+        .it_value = {.tv_nsec = 1000000000 / 60},
+    };
+    timerfd_settime(fd, 0, &period, NULL);
+
+    return fd;
+}
+
+void printUsage() {
+    printf("Usage: %s [-f emulation_freq] socket_path rom_file...\n",
+           PROG_NAME);
+}
+
+int main(int argc, char* p_argv[]) {
+    printf("%s version %s\n\n", PROG_NAME, VERSION);
+
+    int opt;
+    while ((opt = getopt(argc, p_argv, "f:")) != -1) {
+        switch (opt) {
+            case 'f':
+                g_emulationFreq = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                printUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < 2 || argc - optind - 1 > 256 || g_emulationFreq == 0) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    const char* p_socketPath = p_argv[optind];
+    g_sessionCount = argc - optind - 1;
+    gp_sessions = calloc(g_sessionCount, sizeof(*gp_sessions));
+    if (gp_sessions == NULL) return EXIT_FAILURE;
+    for (size_t i = 0; i < g_sessionCount; i++)
+        if (!loadSession(&gp_sessions[i], p_argv[optind + 1 + i]))
+            return EXIT_FAILURE;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int listenFd = createListener(p_socketPath);
+    int timerFd = createFrameTimer();
+    g_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (listenFd < 0 || timerFd < 0 || g_epollFd < 0) return EXIT_FAILURE;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = LISTENER_TAG};
+    epoll_ctl(g_epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event = (struct epoll_event){.events = EPOLLIN, .data.u64 = TIMER_TAG};
+    epoll_ctl(g_epollFd, EPOLL_CTL_ADD, timerFd, &event);
+
+    printf("Serving %zu machine(s) on %s\n", g_sessionCount, p_socketPath);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int count = epoll_wait(g_epollFd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 == LISTENER_TAG) {
+                acceptClients(listenFd);
+            } else if (events[i].data.u64 == TIMER_TAG) {
+                runFrame(timerFd);
+            } else {
+                Client* p_client = events[i].data.ptr;
+                if (p_client->fd < 0) continue;
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    closeClient(p_client);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT && !flushClient(p_client))
+                    continue;
+                if (events[i].events & EPOLLIN) readClient(p_client);
+            }
+        }
+
+        freeClosedClients();
+    }
+}
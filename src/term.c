@@ -0,0 +1,412 @@
+/*
+ * Terminal frontend, for hosts where no window can be opened.
+ *
+ * The display is drawn with Unicode half blocks (64x16 cells) or braille
+ * patterns (32x8 cells). Every frame only the cells that changed are redrawn,
+ * with all the cursor moves and cells written out at once.
+ *
+ * Terminals only report key presses, so a key is held for `KEY_HOLD_FRAMES`
+ * frames after each press, which the terminal's key repeat keeps extending
+ * while the key is held down. Given the delay before the terminal starts
+ * repeating (`-d`), the first press is held through it, so that holding a key
+ * down doesn't read as a press, a release and another press, at the cost of
+ * taps reading as holds that long.
+ *
+ * With `-r`, the session is recorded as an input movie for `cchip8-replay`.
+ */
+
+// For `cfmakeraw` and `clock_nanosleep`
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcchip8.h"
+#include "movie.h"
+
+#define VERSION "0.1.0"
+#define PROG_NAME "cchip8-term"
+
+
+const char KEYMAP[16] = {
+    'x',
+    '1',
+    '2',
+    '3',
+    'q',
+    'w',
+    'e',
+    'a',
+    's',
+    'd',
+    'z',
+    'c',
+    '4',
+    'r',
+    'f',
+    'v',
+};
+
+// Long enough to bridge the gaps between the terminal's key repeats
+#define KEY_HOLD_FRAMES 8
+
+#define CTRL_C 0x03
+#define CTRL_L 0x0C
+#define ESC 0x1B
+
+// Same colours as the SDL frontend, as 24 bit SGR parameters
+#define OFF_COLOUR "143;145;133"
+#define ON_COLOUR "17;29;43"
+
+#define FRAME_NS (1000000000 / 60)
+// Give up on catching up after falling this far behind
+#define MAX_LAG_FRAMES 4
+
+// Enough for every cell with a cursor move each
+#define OUT_BUF_LEN (64 * 32 * 16)
+
+// Ten seconds apart
+#define KEYFRAME_INTERVAL 600
+
+
+typedef enum EscapeState {
+    ESCAPE_NONE,
+    /// After an ESC
+    ESCAPE_START,
+    /// Inside a control sequence (ESC [), until its final byte
+    ESCAPE_CSI,
+    /// After an SS3 (ESC O), which is followed by a single byte
+    ESCAPE_SS3,
+} EscapeState;
+
+
+struct termios g_originalTermios;
+bool g_braille = false;
+
+// The frame number until which each key is held
+uint64_t g_keyHeldUntil[16] = {};
+// How long a key is held after its first press
+uint64_t g_firstHoldFrames = KEY_HOLD_FRAMES;
+// Escape sequences can be split across reads
+EscapeState g_escapeState = ESCAPE_NONE;
+
+// The glyph index drawn in each cell, or -1 if unknown
+int g_drawnCells[16][64];
+
+
+/* TERMINAL */
+
+void restoreTerminal() {
+    // Show the cursor, reset the colours and leave the alternate screen
+    const char RESTORE[] = "\x1b[?25h\x1b[0m\x1b[?1049l";
+    write(STDOUT_FILENO, RESTORE, sizeof(RESTORE) - 1);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_originalTermios);
+}
+
+void handleSignal(int signal) {
+    restoreTerminal();
+    _exit(128 + signal);
+}
+
+bool setupTerminal() {
+    if (tcgetattr(STDIN_FILENO, &g_originalTermios) < 0) {
+        perror("stdin is not a terminal");
+        return false;
+    }
+
+    struct termios raw = g_originalTermios;
+    cfmakeraw(&raw);
+    // Don't block when no keys have been pressed
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    atexit(&restoreTerminal);
+    signal(SIGTERM, &handleSignal);
+    signal(SIGHUP, &handleSignal);
+
+    // Enter the alternate screen, hide the cursor, set the colours and clear
+    const char SETUP[] = "\x1b[?1049h\x1b[?25l"
+                         "\x1b[38;2;" ON_COLOUR "m\x1b[48;2;" OFF_COLOUR "m"
+                         "\x1b[2J";
+    write(STDOUT_FILENO, SETUP, sizeof(SETUP) - 1);
+
+    return true;
+}
+
+void writeAll(const char* p_buf, size_t len) {
+    while (len > 0) {
+        ssize_t count = write(STDOUT_FILENO, p_buf, len);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p_buf += count;
+        len -= count;
+    }
+}
+
+
+/* INPUT */
+
+/**
+ * Advances through the escape sequences sent for arrow, function and other
+ * special keys, so that their bytes aren't read as key presses.
+ *
+ * @returns Whether `byte` is part of an escape sequence
+ */
+bool skipEscape(char byte) {
+    switch (g_escapeState) {
+        case ESCAPE_NONE:
+            if (byte != ESC) return false;
+            g_escapeState = ESCAPE_START;
+            return true;
+        case ESCAPE_START:
+            if (byte == '[')
+                g_escapeState = ESCAPE_CSI;
+            else if (byte == 'O')
+                g_escapeState = ESCAPE_SS3;
+            // A lone ESC, the byte after it is a key of its own
+            else if (byte != ESC)
+                g_escapeState = ESCAPE_NONE;
+            return g_escapeState != ESCAPE_NONE;
+        case ESCAPE_CSI:
+            // Parameter and intermediate bytes come before the final byte
+            if (byte >= 0x40 && byte <= 0x7E) g_escapeState = ESCAPE_NONE;
+            return true;
+        case ESCAPE_SS3:
+            g_escapeState = ESCAPE_NONE;
+            return true;
+    }
+    return false;
+}
+
+/// @returns Whether to keep running
+bool readKeys(uint64_t frame, bool* p_paused) {
+    char input[64];
+    ssize_t count;
+    while ((count = read(STDIN_FILENO, input, sizeof(input))) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            if (input[i] == CTRL_C) return false;
+            if (skipEscape(input[i])) continue;
+            if (input[i] == CTRL_L)
+                memset(g_drawnCells, -1, sizeof(g_drawnCells));
+            if (input[i] == ' ') *p_paused = !*p_paused;
+
+            for (int key = 0; key < 16; key++)
+                if (tolower((unsigned char)input[i]) == KEYMAP[key])
+                    // Repeats of a held key come in quick succession
+                    g_keyHeldUntil[key] =
+                        frame + (g_keyHeldUntil[key] > frame
+                                     ? KEY_HOLD_FRAMES
+                                     : g_firstHoldFrames);
+        }
+    }
+
+    return true;
+}
+
+uint16_t heldKeys(uint64_t frame) {
+    uint16_t heldKeys = 0;
+    for (int i = 0; i < 16; i++)
+        if (g_keyHeldUntil[i] > frame) heldKeys |= 0b1 << i;
+    return heldKeys;
+}
+
+
+/* DISPLAY */
+
+bool pixel(const uint64_t* p_display, int x, int y) {
+    return p_display[y] >> (63 - x) & 0b1;
+}
+
+/// @returns The glyph index of the cell, which has its pixels as bitflags
+int cellAt(const uint64_t* p_display, int col, int row) {
+    if (!g_braille)
+        return pixel(p_display, col, row * 2) |
+               pixel(p_display, col, row * 2 + 1) << 1;
+
+    // Braille dots are numbered down the left column, then down the right one,
+    // with the bottom row numbered last
+    int x = col * 2, y = row * 4;
+    return pixel(p_display, x, y) | pixel(p_display, x, y + 1) << 1 |
+           pixel(p_display, x, y + 2) << 2 |
+           pixel(p_display, x + 1, y) << 3 |
+           pixel(p_display, x + 1, y + 1) << 4 |
+           pixel(p_display, x + 1, y + 2) << 5 |
+           pixel(p_display, x, y + 3) << 6 |
+           pixel(p_display, x + 1, y + 3) << 7;
+}
+
+/// Appends the UTF-8 encoding of `glyph` to `p_buf`
+size_t encodeCell(char* p_buf, int glyph) {
+    static const char* const HALF_BLOCKS[4] = {" ", "▀", "▄", "█"};
+
+    if (!g_braille) {
+        size_t len = strlen(HALF_BLOCKS[glyph]);
+        memcpy(p_buf, HALF_BLOCKS[glyph], len);
+        return len;
+    }
+
+    // U+2800 plus the dots
+    p_buf[0] = 0xE2;
+    p_buf[1] = 0xA0 | glyph >> 6;
+    p_buf[2] = 0x80 | (glyph & 0x3F);
+    return 3;
+}
+
+void drawDisplay(const uint64_t* p_display) {
+    static char buf[OUT_BUF_LEN];
+    size_t len = 0;
+
+    int rows = g_braille ? 8 : 16;
+    int cols = g_braille ? 32 : 64;
+    // Where the terminal's cursor is, -1 if unknown
+    int cursorRow = -1, cursorCol = -1;
+
+    for (int row = 0; row < rows; row++)
+        for (int col = 0; col < cols; col++) {
+            int glyph = cellAt(p_display, col, row);
+            if (g_drawnCells[row][col] == glyph) continue;
+            g_drawnCells[row][col] = glyph;
+
+            if (row != cursorRow || col != cursorCol)
+                len += sprintf(&buf[len], "\x1b[%i;%iH", row + 1, col + 1);
+            len += encodeCell(&buf[len], glyph);
+            cursorRow = row;
+            cursorCol = col + 1;
+        }
+
+    if (len > 0) writeAll(buf, len);
+}
+
+
+/* MAIN LOOP */
+
+void printUsage() {
+    printf("Usage: %s [-b] [-d repeat_delay_ms] [-f emulation_freq] "
+           "[-r movie_file] [-s seed] rom_file\n",
+           PROG_NAME);
+    printf("  -b  Draw with braille patterns instead of half blocks\n");
+    printf("  -d  The terminal's delay before repeating keys, to hold the "
+           "first press\n      through, 0 by default\n");
+    printf("  -r  Record the session as an input movie\n");
+    printf("  -s  Seed for the random number generator, defaults to the "
+           "time\n");
+}
+
+int main(int argc, char* p_argv[]) {
+    printf("%s version %s\n\n", PROG_NAME, VERSION);
+
+    uint64_t emulationFreq = 500;
+    const char* p_moviePath = NULL;
+    uint32_t seed = time(NULL);
+    int opt;
+    while ((opt = getopt(argc, p_argv, "bd:f:r:s:")) != -1) {
+        switch (opt) {
+            case 'b':
+                g_braille = true;
+                break;
+            case 'd':
+                g_firstHoldFrames =
+                    strtoull(optarg, NULL, 0) * 60 / 1000 + KEY_HOLD_FRAMES;
+                break;
+            case 'f':
+                emulationFreq = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                p_moviePath = optarg;
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                printUsage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || emulationFreq < 60 ||
+        emulationFreq > UINT32_MAX || seed == 0) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    static uint8_t rom[CCHIP8_MAX_ROM_SIZE];
+    size_t romSize;
+    if (!cchip8_loadRom(p_argv[optind], rom, &romSize)) {
+        fprintf(stderr, "ROM file could not be opened\n");
+        return EXIT_FAILURE;
+    }
+
+    // The instructions per frame are set for every frame stepped
+    Cchip8Envs* p_envs = cchip8_create(1, rom, romSize, 0, NULL, 0);
+    if (p_envs == NULL) return EXIT_FAILURE;
+    cchip8_seed(p_envs, 0, seed);
+
+    Movie movie;
+    if (p_moviePath != NULL &&
+        !movie_startRecording(
+            &movie, p_envs, 0, emulationFreq, seed, KEYFRAME_INTERVAL)) {
+        fprintf(stderr, "Not enough memory to record\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!setupTerminal()) return EXIT_FAILURE;
+    memset(g_drawnCells, -1, sizeof(g_drawnCells));
+
+    struct timespec nextFrame;
+    clock_gettime(CLOCK_MONOTONIC, &nextFrame);
+    uint64_t frame = 0;
+    bool paused = false;
+
+    while (readKeys(frame, &paused)) {
+        if (!paused) {
+            uint16_t keys = heldKeys(frame);
+            cchip8_setInstructionsPerFrame(
+                p_envs, cchip8_frameBudget(emulationFreq, frame));
+            cchip8_stepOne(p_envs, 0, keys);
+            frame++;
+            if (p_moviePath != NULL &&
+                !movie_recordFrame(&movie, p_envs, 0, keys))
+                break;
+        }
+        drawDisplay(cchip8_framebuffers(p_envs));
+
+        nextFrame.tv_nsec += FRAME_NS;
+        if (nextFrame.tv_nsec >= 1000000000) {
+            nextFrame.tv_sec++;
+            nextFrame.tv_nsec -= 1000000000;
+        }
+
+        // Don't rush through frames to catch up after a long stall
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t lag = (now.tv_sec - nextFrame.tv_sec) * 1000000000 +
+                      (now.tv_nsec - nextFrame.tv_nsec);
+        if (lag > MAX_LAG_FRAMES * FRAME_NS) nextFrame = now;
+
+        while (clock_nanosleep(
+                   CLOCK_MONOTONIC, TIMER_ABSTIME, &nextFrame, NULL) == EINTR);
+    }
+
+    bool saved = true;
+    if (p_moviePath != NULL) {
+        saved = movie_save(&movie, p_moviePath);
+        movie_free(&movie);
+    }
+    cchip8_destroy(p_envs);
+
+    if (!saved) {
+        restoreTerminal();
+        fprintf(stderr, "Movie could not be saved\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}